@@ -0,0 +1,153 @@
+#include "affinity.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Affinity {
+
+#if defined(__linux__)
+
+  // The cpus the process was allowed to run on, before any thread got pinned
+  const cpu_set_t& processMask() {
+    static cpu_set_t mask = [] {
+      cpu_set_t m;
+      CPU_ZERO(&m);
+      if (sched_getaffinity(0, sizeof(m), &m) != 0)
+        CPU_ZERO(&m);
+      return m;
+    }();
+    return mask;
+  }
+
+  int readInt(const std::string& path, int defaultValue) {
+    std::ifstream file(path);
+    int value;
+    return (file >> value) ? value : defaultValue;
+  }
+
+  // The first cpu sharing the L3 cache with this one identifies the L3 domain
+  int l3Domain(int cpu) {
+    const std::string cacheDir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+
+    for (int index = 0; index < 10; index++) {
+      if (readInt(cacheDir + std::to_string(index) + "/level", 0) != 3)
+        continue;
+
+      std::vector<int> shared = Memory::readIdList(cacheDir + std::to_string(index) + "/shared_cpu_list");
+      if (!shared.empty())
+        return shared[0];
+    }
+
+    return -1;
+  }
+
+  std::vector<Cpu> pinningOrder() {
+    const cpu_set_t& mask = processMask();
+
+    std::map<int, int> nodeOf;
+    for (int node : Memory::onlineNumaNodes())
+      for (int cpu : Memory::readIdList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+        nodeOf[cpu] = node;
+
+    std::vector<Cpu> cpus;
+
+    for (int id : Memory::readIdList("/sys/devices/system/cpu/online")) {
+      if (id >= CPU_SETSIZE || !CPU_ISSET(id, &mask))
+        continue;
+
+      const std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+      std::vector<int> siblings = Memory::readIdList(topology + "thread_siblings_list");
+
+      Cpu cpu;
+      cpu.id = id;
+      cpu.core = readInt(topology + "core_id", id);
+      cpu.package = readInt(topology + "physical_package_id", 0);
+      cpu.node = nodeOf.count(id) ? nodeOf[id] : 0;
+      cpu.l3 = l3Domain(id);
+      cpu.smt = std::max<int>(0, std::find(siblings.begin(), siblings.end(), id) - siblings.begin());
+
+      if (cpu.l3 < 0)
+        cpu.l3 = cpu.package;
+
+      cpus.push_back(cpu);
+    }
+
+    // For each SMT level: a queue per node, which takes turns between the L3 domains of the node.
+    // Then the nodes take turns
+    std::vector<Cpu> order;
+
+    for (int smt = 0; order.size() < cpus.size(); smt++) {
+      std::map<int, std::map<int, std::vector<Cpu>>> byNodeAndL3;
+      for (const Cpu& cpu : cpus)
+        if (cpu.smt == smt)
+          byNodeAndL3[cpu.node][cpu.l3].push_back(cpu);
+
+      if (byNodeAndL3.empty())
+        break;
+
+      std::vector<std::vector<Cpu>> nodeQueues;
+      for (auto& [node, byL3] : byNodeAndL3) {
+        std::vector<Cpu> queue;
+        for (size_t i = 0; ; i++) {
+          bool any = false;
+          for (auto& [l3, l3Cpus] : byL3)
+            if (i < l3Cpus.size()) {
+              queue.push_back(l3Cpus[i]);
+              any = true;
+            }
+          if (!any)
+            break;
+        }
+        nodeQueues.push_back(queue);
+      }
+
+      for (size_t i = 0; ; i++) {
+        bool any = false;
+        for (const std::vector<Cpu>& queue : nodeQueues)
+          if (i < queue.size()) {
+            order.push_back(queue[i]);
+            any = true;
+          }
+        if (!any)
+          break;
+      }
+    }
+
+    return order;
+  }
+
+  bool pinCurrentThread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+  }
+
+  void unpinCurrentThread() {
+    if (CPU_COUNT(&processMask()))
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &processMask());
+  }
+
+#else
+
+  std::vector<Cpu> pinningOrder() {
+    return {};
+  }
+
+  bool pinCurrentThread(int) {
+    return false;
+  }
+
+  void unpinCurrentThread() {}
+
+#endif
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+
+namespace Affinity {
+
+  struct Cpu {
+    int id;
+    int core, package, node, l3;
+
+    // Index of this cpu among the SMT siblings of its core, 0 for the first one
+    int smt;
+  };
+
+  /// The cpus this process may run on, in the order search threads should be pinned to them:
+  /// one per physical core first, then their SMT siblings. Consecutive cpus are spread
+  /// round robin across NUMA nodes, and within a node across L3 domains.
+  /// Empty if the topology can't be read
+  std::vector<Cpu> pinningOrder();
+
+  /// Pin the calling thread to a cpu. Returns false on failure
+  bool pinCurrentThread(int cpu);
+
+  /// Let the calling thread run on any cpu the process could run on at startup
+  void unpinCurrentThread();
+}
@@ -25,11 +25,32 @@ Bitboard RookTable[102400];
 
 #else
 
+// With USE_DISPATCH these are indexed either by magics or by pext, depending on the
+// CPU we are running on. Both index ranges fit in the same tables
 Bitboard BishopAttacks[64][512];
 Bitboard RookAttacks[64][4096];
 
 #endif
 
+#if defined(USE_DISPATCH)
+
+bool usePext = false;
+
+// Compiled for bmi2, so that pext is a single inlined instruction. Only called when the
+// CPU has it. A plain function can't inline these, so the lookups below dispatch once,
+// to a bmi2 version of the whole lookup
+__attribute__((target("bmi2")))
+uint32_t attack_index_bishop_pext(Square sq, Bitboard occupied) {
+  return (uint32_t)_pext_u64(occupied, BishopMasks[sq]);
+}
+
+__attribute__((target("bmi2")))
+uint32_t attack_index_rook_pext(Square sq, Bitboard occupied) {
+  return (uint32_t)_pext_u64(occupied, RookMasks[sq]);
+}
+
+#endif
+
 
 Bitboard king_attacks[SQUARE_NB];
 
@@ -240,6 +261,10 @@ uint32_t attack_index_bishop(Square sq, Bitboard occupied) {
 #if defined(USE_PEXT)
   return (uint32_t)_pext_u64(occupied, BishopMasks[sq]);
 #else
+#if defined(USE_DISPATCH)
+  if (usePext)
+    return attack_index_bishop_pext(sq, occupied);
+#endif
   return (occupied & BishopMasks[sq]) * BISHOP_MAGICS[sq] >> 55;
 #endif
 }
@@ -248,17 +273,43 @@ uint32_t attack_index_rook(Square sq, Bitboard occupied) {
 #if defined(USE_PEXT)
   return (uint32_t)_pext_u64(occupied, RookMasks[sq]);
 #else
+#if defined(USE_DISPATCH)
+  if (usePext)
+    return attack_index_rook_pext(sq, occupied);
+#endif
   return (occupied & RookMasks[sq]) * ROOK_MAGICS[sq] >> 52;
 #endif
 }
 
+#if defined(USE_DISPATCH)
+
+__attribute__((target("bmi2")))
+Bitboard getBishopAttacksPext(Square sq, Bitboard occupied) {
+  return BishopAttacks[sq][attack_index_bishop_pext(sq, occupied)];
+}
+
+__attribute__((target("bmi2")))
+Bitboard getRookAttacksPext(Square sq, Bitboard occupied) {
+  return RookAttacks[sq][attack_index_rook_pext(sq, occupied)];
+}
+
+#endif
+
 // lookup bishop attacks 
 Bitboard getBishopAttacks(Square sq, Bitboard occupied) {
+#if defined(USE_DISPATCH)
+  if (usePext)
+    return getBishopAttacksPext(sq, occupied);
+#endif
 	return BishopAttacks[sq][attack_index_bishop(sq, occupied)];
 }
 
 // lookup rook attacks 
 Bitboard getRookAttacks(Square sq, Bitboard occupied) {  
+#if defined(USE_DISPATCH)
+  if (usePext)
+    return getRookAttacksPext(sq, occupied);
+#endif
 	return RookAttacks[sq][attack_index_rook(sq, occupied)];
 }
 
@@ -338,13 +389,10 @@ void init_fancy_magic_attacks(Bitboard masks[],
         {
             Bitboard occupancy = set_occupancy(count, bit_count, masks[sq]);
 
-            if (pt == BISHOP) {
-              Bitboard magic_index = occupancy * BISHOP_MAGICS[sq] >> 55; 
-              BishopAttacks[sq][magic_index] = sliding_attack(deltas, sq, occupancy); 
-            } else {
-              Bitboard magic_index = occupancy * ROOK_MAGICS[sq] >> 52; 
-              RookAttacks[sq][magic_index] = sliding_attack(deltas, sq, occupancy); 
-            }
+            if (pt == BISHOP)
+              BishopAttacks[sq][attack_index_bishop(sq, occupancy)] = sliding_attack(deltas, sq, occupancy);
+            else
+              RookAttacks[sq][attack_index_rook(sq, occupancy)] = sliding_attack(deltas, sq, occupancy);
         }
     }
 }
@@ -353,7 +401,24 @@ void init_fancy_magic_attacks(Bitboard masks[],
 
 namespace Bitboards {
 
+  bool pextEnabled() {
+#if defined(USE_PEXT)
+    return true;
+#elif defined(USE_DISPATCH)
+    return usePext;
+#else
+    return false;
+#endif
+  }
+
   void init() {
+#if defined(USE_DISPATCH)
+    // Zen 1 and 2 implement pext in microcode, magics are much faster there
+    usePext =  __builtin_cpu_supports("bmi2")
+           && !__builtin_cpu_is("znver1")
+           && !__builtin_cpu_is("znver2");
+#endif
+
     for (Square sq = SQ_A1; sq < SQUARE_NB; ++sq) {
       king_attacks[sq] = gen_king_attacks(sq);
 
@@ -254,5 +254,8 @@ constexpr Bitboard BISHOP_MAGICS[64] = {
 };
 
 namespace Bitboards {
+  /// Whether slider attacks are indexed with pext instead of magics
+  bool pextEnabled();
+
   void init();
 }
\ No newline at end of file
@@ -5,8 +5,10 @@
 namespace Eval {
 
   Score evaluate(Position& pos, NNUE::Accumulator& accumulator) {
+    return adjust(pos, NNUE::evaluate(pos, accumulator));
+  }
 
-    Score score = NNUE::evaluate(pos, accumulator);
+  Score adjust(Position& pos, Score score) {
 
     int phase =  3 * BitCount(pos.pieces(KNIGHT))
                + 3 * BitCount(pos.pieces(BISHOP))
@@ -6,4 +6,8 @@ namespace Eval {
 
   /// <returns> A value relative to the side to move </returns>
   Score evaluate(Position& pos, NNUE::Accumulator& accumulator);
+
+  /// The evaluation, from the raw output of the network. The output depends only on the
+  /// pieces and side to move, this adds what depends on the rest of the position
+  Score adjust(Position& pos, Score nnueScore);
 }
\ No newline at end of file
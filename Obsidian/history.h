@@ -2,18 +2,43 @@
 
 #include "types.h"
 
+#include <cstdint>
+
+// History values are kept within [-16384, 16384] by the gravity of addToHistory,
+// so they are stored as int16_t, halving the cache footprint of the tables.
+// Building with HISTORY_INT32 stores them as int: both must give the same bench
+#if defined(HISTORY_INT32)
+using HistoryValue = int;
+#else
+using HistoryValue = int16_t;
+#endif
+
+// Multi dimensional array of history values, History<A, B> is HistoryValue[A][B]
+template <int Size, int... Sizes>
+struct HistoryArray {
+  using type = typename HistoryArray<Sizes...>::type[Size];
+};
+
+template <int Size>
+struct HistoryArray<Size> {
+  using type = HistoryValue[Size];
+};
+
+template <int... Sizes>
+using History = typename HistoryArray<Sizes...>::type;
+
 // [color][from to]
-using MainHistory  = int[COLOR_NB][SQUARE_NB * SQUARE_NB];
+using MainHistory = History<COLOR_NB, SQUARE_NB * SQUARE_NB>;
 
 // [piece to][piece_type]
-using CaptureHistory = int[PIECE_NB * SQUARE_NB][PIECE_TYPE_NB];
+using CaptureHistory = History<PIECE_NB * SQUARE_NB, PIECE_TYPE_NB>;
 
 // [piece to]
 using CounterMoveHistory = Move[PIECE_NB * SQUARE_NB];
 
 // [isCap][piece to][piece to]
-using ContinuationHistory = int[2][PIECE_NB * SQUARE_NB][PIECE_NB * SQUARE_NB];
+using ContinuationHistory = History<2, PIECE_NB * SQUARE_NB, PIECE_NB * SQUARE_NB>;
 
-inline void addToHistory(int& history, int value) {
+inline void addToHistory(HistoryValue& history, int value) {
   history += value - history * abs(value) / 16384;
-}
\ No newline at end of file
+}
@@ -1,7 +1,9 @@
 // Obsidian.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include "bitboard.h"
 #include "cuckoo.h"
+#include "nnue.h"
 #include "threads.h"
 #include "tt.h"
 #include "uci.h"
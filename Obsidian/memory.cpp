@@ -0,0 +1,162 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Memory {
+
+  constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+  size_t roundToHugePage(size_t bytes) {
+    return (bytes + HugePageSize - 1) / HugePageSize * HugePageSize;
+  }
+
+  void* alignedAlloc(size_t alignment, size_t bytes) {
+    // std::aligned_alloc wants a size multiple of the alignment
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+
+#if defined(_WIN32)
+    return _aligned_malloc(bytes, alignment);
+#else
+    return std::aligned_alloc(alignment, bytes);
+#endif
+  }
+
+  void alignedFree(void* mem) {
+#if defined(_WIN32)
+    _aligned_free(mem);
+#else
+    std::free(mem);
+#endif
+  }
+
+  std::vector<int> readIdList(const std::string& path) {
+    std::vector<int> ids;
+
+    std::ifstream file(path);
+    std::string range;
+
+    while (std::getline(file, range, ',')) {
+      int first, last;
+      char dash;
+      std::istringstream is(range);
+
+      if (!(is >> first))
+        continue;
+      if (!(is >> dash >> last))
+        last = first;
+
+      for (int id = first; id <= last; id++)
+        ids.push_back(id);
+    }
+
+    return ids;
+  }
+
+  std::vector<int> onlineNumaNodes() {
+#if defined(__linux__)
+    return readIdList("/sys/devices/system/node/online");
+#else
+    return {};
+#endif
+  }
+
+  bool transparentHugePagesEnabled() {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string setting;
+    std::getline(file, setting);
+
+    // The active setting is the one in brackets
+    return file && setting.find("[never]") == std::string::npos;
+  }
+
+  void* largePageAlloc(size_t bytes, PageType& pageType) {
+    bytes = roundToHugePage(bytes);
+    pageType = PAGES_NORMAL;
+
+#if defined(__linux__)
+
+    // Explicit huge pages, only available if the admin reserved some
+    void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mem != MAP_FAILED) {
+      pageType = PAGES_HUGETLB;
+      return mem;
+    }
+
+    mem = alignedAlloc(HugePageSize, bytes);
+    if (mem && madvise(mem, bytes, MADV_HUGEPAGE) == 0 && transparentHugePagesEnabled())
+      pageType = PAGES_TRANSPARENT_HUGE;
+
+    return mem;
+
+#else
+
+    return alignedAlloc(HugePageSize, bytes);
+
+#endif
+  }
+
+  void largePageFree(void* mem, size_t bytes, PageType pageType) {
+    if (!mem)
+      return;
+
+#if defined(__linux__)
+    if (pageType == PAGES_HUGETLB) {
+      munmap(mem, roundToHugePage(bytes));
+      return;
+    }
+#endif
+
+    alignedFree(mem);
+  }
+
+  bool numaInterleave(void* mem, size_t bytes) {
+
+#if defined(__linux__) && defined(SYS_mbind)
+    constexpr int MPOL_INTERLEAVE = 3;
+    constexpr int MaxNodes = 1024;
+
+    std::vector<int> nodes = onlineNumaNodes();
+    if (nodes.size() <= 1)
+      return false;
+
+    uint64_t nodeMask[MaxNodes / 64] = {};
+    for (int node : nodes) {
+      if (node < MaxNodes)
+        nodeMask[node / 64] |= 1ULL << (node % 64);
+    }
+
+    return syscall(SYS_mbind, mem, roundToHugePage(bytes), MPOL_INTERLEAVE,
+                   nodeMask, MaxNodes, 0) == 0;
+#else
+    return false;
+#endif
+  }
+
+  int numaNodeCount() {
+    return std::max<int>(1, onlineNumaNodes().size());
+  }
+
+  std::string pageTypeToString(PageType pageType) {
+    switch (pageType) {
+    case PAGES_HUGETLB:          return "huge pages (hugetlb)";
+    case PAGES_TRANSPARENT_HUGE: return "transparent huge pages";
+    default:                     return "normal pages";
+    }
+  }
+}
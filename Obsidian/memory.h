@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Memory {
+
+  /// Allocate memory aligned to alignment (a power of two), free it with alignedFree.
+  /// Returns nullptr on failure
+  void* alignedAlloc(size_t alignment, size_t bytes);
+
+  void alignedFree(void* mem);
+
+  enum PageType {
+    PAGES_NORMAL, PAGES_TRANSPARENT_HUGE, PAGES_HUGETLB
+  };
+
+  /// Allocate memory aligned to 2MB, backed by huge pages if the OS allows it.
+  /// Returns nullptr on failure
+  void* largePageAlloc(size_t bytes, PageType& pageType);
+
+  void largePageFree(void* mem, size_t bytes, PageType pageType);
+
+  /// Spread the pages of the given memory round robin over all NUMA nodes.
+  /// Must be called before the memory is touched. Returns false if nothing was done
+  bool numaInterleave(void* mem, size_t bytes);
+
+  int numaNodeCount();
+
+  /// Read a sysfs list of ids, like "0-3,8,10-11". Empty if the file doesn't exist
+  std::vector<int> readIdList(const std::string& path);
+
+  std::vector<int> onlineNumaNodes();
+
+  std::string pageTypeToString(PageType pageType);
+}
@@ -1,25 +1,71 @@
 #include "nnue.h"
 #include "bitboard.h"
 #include "incbin.h"
+#include "memory.h"
 #include "position.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NNUE_MMAP
+#endif
 
 INCBIN(EmbeddedNNUE, EvalFile);
 
 namespace NNUE {
 
-  constexpr int WeightsPerVec = sizeof(SIMD::Vec) / sizeof(weight_t);
-
-  struct {
+  struct Network {
     alignas(SIMD::Alignment) weight_t FeatureWeights[KingBucketsCount][2][6][64][HiddenWidth];
     alignas(SIMD::Alignment) weight_t FeatureBiases[HiddenWidth];
     alignas(SIMD::Alignment) weight_t OldOutputWeights[2 * HiddenWidth][OutputBuckets];
                              weight_t OutputBias[OutputBuckets];
-  } Content;
+  };
+
+  // Size of the weights in a network file. sizeof(Network) adds some padding after them,
+  // files are accepted both with and without it
+  constexpr size_t NetworkBytes = offsetof(Network, OutputBias) + sizeof(Network::OutputBias);
+
+  using OutputWeights = weight_t[OutputBuckets][2 * HiddenWidth];
+
+  // The network in use. Its weights are used in place, wherever they are (the embedded
+  // data or a mapping of the file), unless they aren't aligned for SIMD loads: then they are copied
+  struct LoadedNetwork {
+    const Network* content = nullptr;
+    std::string name;
+    uint64_t hash;
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    Network* copy = nullptr;
 
-  alignas(SIMD::Alignment) weight_t NewOutputWeights[OutputBuckets][2 * HiddenWidth];
+    // OldOutputWeights transposed, in the layout the output layer wants. Built on first use,
+    // unless the network lives in shared memory, which has them ready
+    std::atomic<OutputWeights*> outputWeights { nullptr };
+    bool shared = false;
+
+    ~LoadedNetwork();
+  };
+
+  LoadedNetwork* network;
+
+  // Incremented whenever the network changes
+  uint64_t generation = 0;
+
+  std::mutex outputWeightsMutex;
 
   bool needRefresh(Color side, Square oldKing, Square newKing) {
     const bool oldMirrored = fileOf(oldKing) >= FILE_E;
@@ -32,130 +78,160 @@ namespace NNUE {
           != KingBucketsScheme[relative_square(side, newKing)];
   }
 
-  inline weight_t* featureAddress(Square kingSq, Color side, Piece pc, Square sq) {
+  inline const weight_t* featureAddress(Square kingSq, Color side, Piece pc, Square sq) {
     if (fileOf(kingSq) >= FILE_E)
       sq = Square(sq ^ 7);
 
-    return Content.FeatureWeights
+    return network->content->FeatureWeights
             [KingBucketsScheme[relative_square(side, kingSq)]]
             [side != piece_color(pc)]
             [piece_type(pc)-1]
             [relative_square(side, sq)];
   }
 
-  template <int InputSize>
-  inline void multiAdd(weight_t* output, weight_t* input, weight_t* add0){
-    Vec* inputVec = (Vec*)input;
-    Vec* outputVec = (Vec*)output;
-    Vec* add0Vec = (Vec*) add0;
-
-    for (int i = 0; i < InputSize / WeightsPerVec; ++i)
-      outputVec[i] = addEpi16(inputVec[i], add0Vec[i]);
+  // Kernels for one instruction set. Each set of simd.h gets its own copy,
+  // see nnuekernels.h
+  struct KernelSet {
+    void (*multiSubAdd)(weight_t*, const weight_t*, const weight_t*, const weight_t*);
+    void (*multiSubAddSub)(weight_t*, const weight_t*, const weight_t*, const weight_t*, const weight_t*);
+    void (*multiSubAddSubAdd)(weight_t*, const weight_t*,
+                              const weight_t*, const weight_t*, const weight_t*, const weight_t*);
+    void (*multiAddSub)(weight_t*, const weight_t*, const weight_t* const*, int, const weight_t* const*, int);
+    int (*outputLayer)(const weight_t*, const weight_t*, const weight_t*, const weight_t*);
+    const char* name;
+  };
+
+#if defined(USE_DISPATCH)
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+  namespace Avx512 {
+    using namespace SIMD::Avx512;
+    #include "nnuekernels.h"
   }
+#pragma GCC pop_options
 
-  template <int InputSize>
-  inline void multiSub(weight_t* output, weight_t* input, weight_t* sub0){
-    Vec* inputVec = (Vec*)input;
-    Vec* outputVec = (Vec*)output;
-    Vec* sub0Vec = (Vec*) sub0;
-
-    for (int i = 0; i < InputSize / WeightsPerVec; ++i)
-      outputVec[i] = subEpi16(inputVec[i], sub0Vec[i]);
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vnni")
+  namespace Avx512Vnni {
+    using namespace SIMD::Avx512Vnni;
+    #include "nnuekernels.h"
   }
+#pragma GCC pop_options
 
-  template <int InputSize>
-  inline void multiAddAdd(weight_t* output, weight_t* input, weight_t* add0, weight_t* add1){
-    Vec* inputVec = (Vec*)input;
-    Vec* outputVec = (Vec*)output;
-    Vec* add0Vec = (Vec*) add0;
-    Vec* add1Vec = (Vec*) add1;
-
-    for (int i = 0; i < InputSize / WeightsPerVec; ++i)
-      outputVec[i] = addEpi16(inputVec[i], addEpi16(add0Vec[i], add1Vec[i]));
+#pragma GCC push_options
+#pragma GCC target("avx2,avxvnni")
+  namespace Avx2Vnni {
+    using namespace SIMD::Avx2Vnni;
+    #include "nnuekernels.h"
   }
+#pragma GCC pop_options
 
-  template <int InputSize>
-  inline void multiSubAdd(weight_t* output, weight_t* input, weight_t* sub0, weight_t* add0) {
-    Vec* inputVec = (Vec*)input;
-    Vec* outputVec = (Vec*)output;
-
-    Vec* sub0Vec = (Vec*) sub0;
-    Vec* add0Vec = (Vec*) add0;
-        
-    for (int i = 0; i < InputSize / WeightsPerVec; ++i)
-      outputVec[i] = subEpi16(addEpi16(inputVec[i], add0Vec[i]), sub0Vec[i]);
+#pragma GCC push_options
+#pragma GCC target("avx2")
+  namespace Avx2 {
+    using namespace SIMD::Avx2;
+    #include "nnuekernels.h"
   }
+#pragma GCC pop_options
 
-  template <int InputSize>
-  inline void multiSubAddSub(weight_t* output, weight_t* input, weight_t* sub0, weight_t* add0, weight_t* sub1) {
-    Vec* inputVec = (Vec*)input;
-    Vec* outputVec = (Vec*)output;
-
-    Vec* sub0Vec = (Vec*) sub0;
-    Vec* add0Vec = (Vec*) add0;
-    Vec* sub1Vec = (Vec*) sub1;
-
-    for (int i = 0; i < InputSize / WeightsPerVec; ++i)
-      outputVec[i] = subEpi16(subEpi16(addEpi16(inputVec[i], add0Vec[i]), sub0Vec[i]), sub1Vec[i]);
+  namespace Sse2 {
+    using namespace SIMD::Sse2;
+    #include "nnuekernels.h"
   }
 
-   template <int InputSize>
-  inline void multiSubAddSubAdd(weight_t* output, weight_t* input, weight_t* sub0, weight_t* add0, weight_t* sub1, weight_t* add1) {
-    Vec* inputVec = (Vec*)input;
-    Vec* outputVec = (Vec*)output;
+  // Chosen in init(), see pickKernels()
+  KernelSet kernels = Sse2::Kernels;
 
-    Vec* sub0Vec = (Vec*) sub0;
-    Vec* add0Vec = (Vec*) add0;
-    Vec* sub1Vec = (Vec*) sub1;
-    Vec* add1Vec = (Vec*) add1;
+#else
 
-    for (int i = 0; i < InputSize / WeightsPerVec; ++i)
-      outputVec[i] = addEpi16(subEpi16(subEpi16(addEpi16(inputVec[i], add0Vec[i]), sub0Vec[i]), sub1Vec[i]), add1Vec[i]);
+  namespace Selected {
+    #include "nnuekernels.h"
   }
 
-  void Accumulator::addPiece(Square kingSq, Color side, Piece pc, Square sq) {
-    multiAdd<HiddenWidth>(colors[side], colors[side], featureAddress(kingSq, side, pc, sq));
+  constexpr KernelSet kernels = Selected::Kernels;
+
+#endif
+
+  // The kernel sets of this binary which the CPU can run, widest first.
+  // A VNNI set comes right before the plain set of the same width
+  std::vector<KernelSet> availableKernels() {
+    std::vector<KernelSet> sets;
+
+#if defined(USE_DISPATCH)
+    const bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+
+    if (avx512 && __builtin_cpu_supports("avx512vnni"))
+      sets.push_back(Avx512Vnni::Kernels);
+    if (avx512)
+      sets.push_back(Avx512::Kernels);
+    if (avx2 && __builtin_cpu_supports("avxvnni"))
+      sets.push_back(Avx2Vnni::Kernels);
+    if (avx2)
+      sets.push_back(Avx2::Kernels);
+    sets.push_back(Sse2::Kernels);
+#else
+    sets.push_back(kernels);
+#endif
+
+    return sets;
   }
 
-  void Accumulator::removePiece(Square kingSq, Color side, Piece pc, Square sq) {
-    multiSub<HiddenWidth>(colors[side], colors[side], featureAddress(kingSq, side, pc, sq));
+  void Accumulator::addRemovePieces(Square kingSq, Color side, const SquarePiece* adds, int addCount,
+                                    const SquarePiece* removes, int removeCount)
+  {
+    const weight_t* addWeights[32];
+    const weight_t* removeWeights[32];
+
+    for (int i = 0; i < addCount; i++)
+      addWeights[i] = featureAddress(kingSq, side, adds[i].pc, adds[i].sq);
+    for (int i = 0; i < removeCount; i++)
+      removeWeights[i] = featureAddress(kingSq, side, removes[i].pc, removes[i].sq);
+
+    kernels.multiAddSub(colors[side], colors[side], addWeights, addCount, removeWeights, removeCount);
   }
 
   void Accumulator::doUpdates(Square kingSq, Color side, DirtyPieces& dp, Accumulator& input) {
     
     if (dp.type == DirtyPieces::CASTLING) 
     {
-      multiSubAddSubAdd<HiddenWidth>(colors[side], input.colors[side], 
+      kernels.multiSubAddSubAdd(colors[side], input.colors[side], 
         featureAddress(kingSq, side, dp.sub0.pc, dp.sub0.sq),
         featureAddress(kingSq, side, dp.add0.pc, dp.add0.sq),
         featureAddress(kingSq, side, dp.sub1.pc, dp.sub1.sq),
         featureAddress(kingSq, side, dp.add1.pc, dp.add1.sq));
     } else if (dp.type == DirtyPieces::CAPTURE) 
     { 
-      multiSubAddSub<HiddenWidth>(colors[side], input.colors[side], 
+      kernels.multiSubAddSub(colors[side], input.colors[side], 
         featureAddress(kingSq, side, dp.sub0.pc, dp.sub0.sq),
         featureAddress(kingSq, side, dp.add0.pc, dp.add0.sq),
         featureAddress(kingSq, side, dp.sub1.pc, dp.sub1.sq));
     } else
     {
-      multiSubAdd<HiddenWidth>(colors[side], input.colors[side], 
+      kernels.multiSubAdd(colors[side], input.colors[side], 
         featureAddress(kingSq, side, dp.sub0.pc, dp.sub0.sq),
         featureAddress(kingSq, side, dp.add0.pc, dp.add0.sq));
     }
   }
 
   void Accumulator::reset(Color side) {
-    memcpy(colors[side], Content.FeatureBiases, sizeof(Content.FeatureBiases));
+    memcpy(colors[side], network->content->FeatureBiases, sizeof(Network::FeatureBiases));
   }
 
   void Accumulator::refresh(Position& pos, Color side) {
-    reset(side);
     const Square kingSq = pos.kingSquare(side);
+
+    const weight_t* addWeights[32];
+    int addCount = 0;
+
     Bitboard occupied = pos.pieces();
     while (occupied) {
       const Square sq = popLsb(occupied);
-      addPiece(kingSq, side, pos.board[sq], sq);
+      addWeights[addCount++] = featureAddress(kingSq, side, pos.board[sq], sq);
     }
+
+    kernels.multiAddSub(colors[side], network->content->FeatureBiases, addWeights, addCount, nullptr, 0);
   }
 
   void FinnyEntry::reset() {
@@ -165,15 +241,451 @@ namespace NNUE {
     acc.reset(BLACK);
   }
 
-  void init() {
+  void refreshFromFinny(FinnyTable& finny, Position& pos, Accumulator& acc, Color side) {
+    const Square king = pos.kingSquare(side);
+    const int bucket = KingBucketsScheme[relative_square(side, king)];
+    FinnyEntry& entry = finny[fileOf(king) >= FILE_E][bucket];
+
+    SquarePiece adds[32], removes[32];
+    int addCount = 0, removeCount = 0;
+
+    for (Color c = WHITE; c <= BLACK; ++c) {
+      for (PieceType pt = PAWN; pt <= KING; ++pt) {
+        const Bitboard oldBB = entry.byColorBB[side][c] & entry.byPieceBB[side][pt];
+        const Bitboard newBB = pos.pieces(c, pt);
+        Bitboard toRemove = oldBB & ~newBB;
+        Bitboard toAdd = newBB & ~oldBB;
+
+        while (toRemove)
+          removes[removeCount++] = { popLsb(toRemove), makePiece(c, pt) };
+        while (toAdd)
+          adds[addCount++] = { popLsb(toAdd), makePiece(c, pt) };
+      }
+    }
 
-    memcpy(&Content, gEmbeddedNNUEData, sizeof(Content));
-    
-    for (int i = 0; i < 2 * HiddenWidth; i++) {
-      for (int j = 0; j < OutputBuckets; j++) {
-        NewOutputWeights[j][i] = Content.OldOutputWeights[i][j];
+    entry.acc.addRemovePieces(king, side, adds, addCount, removes, removeCount);
+
+    memcpy(acc.colors[side], entry.acc.colors[side], sizeof(acc.colors[0]));
+    memcpy(entry.byColorBB[side], pos.byColorBB, sizeof(entry.byColorBB[0]));
+    memcpy(entry.byPieceBB[side], pos.byPieceBB, sizeof(entry.byPieceBB[0]));
+  }
+
+  LoadedNetwork::~LoadedNetwork() {
+#if defined(NNUE_MMAP)
+    if (mapping)
+      munmap(mapping, mappingSize);
+#endif
+    Memory::alignedFree(copy);
+    if (!shared)
+      Memory::alignedFree(outputWeights.load());
+  }
+
+  void transposeOutputWeights(const Network& content, OutputWeights& weights) {
+    for (int i = 0; i < 2 * HiddenWidth; i++)
+      for (int j = 0; j < OutputBuckets; j++)
+        weights[j][i] = content.OldOutputWeights[i][j];
+  }
+
+  // FNV-1a over 64 bit words
+  uint64_t fnv1a(const void* data, size_t bytes) {
+    const uint64_t* words = (const uint64_t*) data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < bytes / sizeof(uint64_t); i++)
+      hash = (hash ^ words[i]) * 0x100000001b3ULL;
+    return hash;
+  }
+
+  // Validate the weights and wrap them in a LoadedNetwork. A file must end with an 8 byte
+  // checksum (fnv1a of the weights), written by signNetwork. Returns nullptr on error
+  LoadedNetwork* makeNetwork(const void* data, size_t size, const std::string& name, bool embedded) {
+    const bool hasChecksum = size == NetworkBytes + 8 || size == sizeof(Network) + 8;
+
+    if (embedded ? size < NetworkBytes : !hasChecksum) {
+      std::cout << "info string Network " << name << " has the wrong size: " << size
+                << " bytes, expected " << NetworkBytes + 8 << " (weights and checksum)";
+      if (!embedded && (size == NetworkBytes || size == sizeof(Network)))
+        std::cout << ", add the checksum with 'nnuesign <input> <output>'";
+      std::cout << std::endl;
+      return nullptr;
+    }
+
+    const uint64_t hash = fnv1a(data, NetworkBytes);
+
+    if (!embedded) {
+      uint64_t checksum;
+      memcpy(&checksum, (const char*) data + size - 8, 8);
+
+      if (checksum != hash) {
+        std::cout << "info string Network " << name << " is corrupted, checksum mismatch" << std::endl;
+        return nullptr;
+      }
+    }
+
+    LoadedNetwork* net = new LoadedNetwork();
+    net->name = name;
+    net->hash = hash;
+
+    if (uintptr_t(data) % alignof(Network) == 0)
+      net->content = (const Network*) data;
+    else {
+      net->copy = (Network*) Memory::alignedAlloc(alignof(Network), sizeof(Network));
+      memcpy(net->copy, data, NetworkBytes);
+      net->content = net->copy;
+    }
+
+    return net;
+  }
+
+  LoadedNetwork* loadFile(const std::string& path) {
+
+#if defined(NNUE_MMAP)
+
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0)
+        close(fd);
+      std::cout << "info string Could not open network " << path << std::endl;
+      return nullptr;
+    }
+
+    const size_t size = st.st_size;
+    void* mapping = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+      std::cout << "info string Could not map network " << path << std::endl;
+      return nullptr;
+    }
+
+    LoadedNetwork* net = makeNetwork(mapping, size, path, false);
+
+    // A mapping is page aligned, so the weights are never copied out of it
+    if (!net)
+      munmap(mapping, size);
+    else {
+      net->mapping = mapping;
+      net->mappingSize = size;
+    }
+
+    return net;
+
+#else
+
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (!file && data.empty()) {
+      std::cout << "info string Could not open network " << path << std::endl;
+      return nullptr;
+    }
+
+    // The vector is gone after this, so the weights must be copied
+    LoadedNetwork* net = makeNetwork(data.data(), data.size(), path, false);
+    if (net && !net->copy) {
+      net->copy = (Network*) Memory::alignedAlloc(alignof(Network), sizeof(Network));
+      memcpy(net->copy, data.data(), NetworkBytes);
+      net->content = net->copy;
+    }
+
+    return net;
+
+#endif
+  }
+
+  void signNetwork(const std::string& input, const std::string& output) {
+    std::ifstream in(input, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // Signing a signed network again replaces its checksum
+    if (   data.size() != NetworkBytes && data.size() != sizeof(Network)
+        && data.size() != NetworkBytes + 8 && data.size() != sizeof(Network) + 8)
+    {
+      std::cout << "info string Network " << input << " has the wrong size: " << data.size()
+                << " bytes, expected " << NetworkBytes << std::endl;
+      return;
+    }
+
+    const uint64_t checksum = fnv1a(data.data(), NetworkBytes);
+
+    std::ofstream out(output, std::ios::binary);
+    out.write(data.data(), NetworkBytes);
+    out.write((const char*) &checksum, sizeof(checksum));
+
+    if (!out) {
+      std::cout << "info string Could not write " << output << std::endl;
+      return;
+    }
+
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) checksum);
+    std::cout << "info string Network " << output << " written, hash " << hash << std::endl;
+  }
+
+#if defined(NNUE_MMAP)
+
+  // Layout of a shared memory segment: this header, the network, then the transposed output weights
+  struct SharedHeader {
+    char magic[8];
+    uint64_t hash;
+    std::atomic<uint32_t> ready;
+  };
+
+  constexpr char SharedMagic[8] = { 'O', 'B', 'S', 'N', 'N', 'U', 'E', '1' };
+
+  constexpr size_t SharedContentOffset = alignof(Network);
+  constexpr size_t SharedOutputOffset  = SharedContentOffset + sizeof(Network);
+  constexpr size_t SharedBytes         = SharedOutputOffset + sizeof(OutputWeights);
+
+  static_assert(sizeof(SharedHeader) <= SharedContentOffset);
+
+  // Create the segment and fill it with net, or map the one another process created.
+  // Sets stale if an existing segment never became usable, like one left behind by a
+  // creator which crashed. Returns MAP_FAILED on failure
+  void* openSharedNetwork(const char* name, LoadedNetwork* net, bool& creator, bool& stale) {
+    stale = false;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    creator = fd >= 0;
+
+    if (!creator)
+      fd = shm_open(name, O_RDONLY, 0);
+
+    void* mapping = MAP_FAILED;
+
+    if (creator) {
+      if (ftruncate(fd, SharedBytes) == 0)
+        mapping = mmap(nullptr, SharedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+      if (mapping != MAP_FAILED) {
+        char* base = (char*) mapping;
+        SharedHeader* header = (SharedHeader*) base;
+
+        memcpy(base + SharedContentOffset, net->content, NetworkBytes);
+        transposeOutputWeights(*net->content, *(OutputWeights*) (base + SharedOutputOffset));
+
+        memcpy(header->magic, SharedMagic, sizeof(SharedMagic));
+        header->hash = net->hash;
+        header->ready.store(1, std::memory_order_release);
+
+        mprotect(mapping, SharedBytes, PROT_READ);
       }
+      else
+        shm_unlink(name);
+    }
+    else if (fd >= 0) {
+      // The creator may still be sizing and filling the segment
+      struct stat st;
+      for (int i = 0; i < 500 && fstat(fd, &st) == 0 && size_t(st.st_size) < SharedBytes; i++)
+        usleep(10000);
+
+      if (fstat(fd, &st) == 0 && size_t(st.st_size) == SharedBytes)
+        mapping = mmap(nullptr, SharedBytes, PROT_READ, MAP_SHARED, fd, 0);
+      else
+        stale = true;
+
+      if (mapping != MAP_FAILED) {
+        const SharedHeader* header = (const SharedHeader*) mapping;
+
+        for (int i = 0; i < 500 && !header->ready.load(std::memory_order_acquire); i++)
+          usleep(10000);
+
+        if (   !header->ready.load(std::memory_order_acquire)
+            || memcmp(header->magic, SharedMagic, sizeof(SharedMagic))
+            || header->hash != net->hash)
+        {
+          munmap(mapping, SharedBytes);
+          mapping = MAP_FAILED;
+          stale = true;
+        }
+      }
+    }
+
+    if (fd >= 0)
+      close(fd);
+
+    return mapping;
+  }
+
+  // Move the network to a shared memory segment, so that every engine process on the host
+  // using it maps the same physical pages. The first process fills the segment, the others
+  // wait until it's ready and map it read only. The name holds the network hash and the
+  // layout of the segment, which depends on the build, so that different builds never attach
+  // to each other's segments. Segments stay in /dev/shm until removed (or a reboot).
+  // Returns net itself on failure
+  LoadedNetwork* shareNetwork(LoadedNetwork* net) {
+    char name[96];
+    snprintf(name, sizeof(name), "/obsidian-nnue-%016llx-a%zu-s%zu",
+             (unsigned long long) net->hash, SharedContentOffset, SharedBytes);
+
+    bool creator, stale;
+    void* mapping = openSharedNetwork(name, net, creator, stale);
+
+    // Remove a segment which will never be ready, and try once more
+    if (stale) {
+      std::cout << "info string Removing the stale network segment /dev/shm" << name << std::endl;
+      shm_unlink(name);
+      mapping = openSharedNetwork(name, net, creator, stale);
+    }
+
+    if (mapping == MAP_FAILED) {
+      std::cout << "info string Could not share the network through /dev/shm" << name
+                << ", using a private copy" << std::endl;
+      return net;
+    }
+
+    LoadedNetwork* sharedNet = new LoadedNetwork();
+    sharedNet->content = (const Network*) ((char*) mapping + SharedContentOffset);
+    sharedNet->name = net->name;
+    sharedNet->hash = net->hash;
+    sharedNet->mapping = mapping;
+    sharedNet->mappingSize = SharedBytes;
+    sharedNet->outputWeights = (OutputWeights*) ((char*) mapping + SharedOutputOffset);
+    sharedNet->shared = true;
+
+    std::cout << "info string Network " << (creator ? "placed in" : "attached from")
+              << " shared memory /dev/shm" << name << std::endl;
+
+    delete net;
+    return sharedNet;
+  }
+
+#endif
+
+  bool load(const std::string& path, bool shared) {
+    LoadedNetwork* net = path.empty()
+      ? makeNetwork(gEmbeddedNNUEData, gEmbeddedNNUESize, "(embedded)", true)
+      : loadFile(path);
+
+    if (!net)
+      return false;
+
+#if defined(NNUE_MMAP)
+    if (shared)
+      net = shareNetwork(net);
+#else
+    if (shared)
+      std::cout << "info string Shared memory networks are not supported on this platform" << std::endl;
+#endif
+
+    delete network;
+    network = net;
+    generation++;
+
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) net->hash);
+
+    if (!path.empty())
+      std::cout << "info string Network " << net->name << " loaded, hash " << hash
+                << (net->shared ? ", shared" : net->mapping ? ", mapped in place" : ", copied") << std::endl;
+
+    return true;
+  }
+
+  const OutputWeights& outputWeights() {
+    OutputWeights* weights = network->outputWeights.load(std::memory_order_acquire);
+    if (weights)
+      return *weights;
+
+    std::lock_guard<std::mutex> lock(outputWeightsMutex);
+
+    weights = network->outputWeights.load(std::memory_order_relaxed);
+    if (!weights) {
+      weights = (OutputWeights*) Memory::alignedAlloc(alignof(Network), sizeof(OutputWeights));
+
+      transposeOutputWeights(*network->content, *weights);
+
+      network->outputWeights.store(weights, std::memory_order_release);
     }
+
+    return *weights;
+  }
+
+  // Time calls to the output layer of set, the only kernel which VNNI changes
+  double outputLayerTime(const KernelSet& set, const Accumulator& acc, const OutputWeights& weights,
+                         int calls, int& checksum)
+  {
+    // Called through a volatile pointer, so that it can't be inlined and hoisted out of the loop
+    int (* volatile outputLayer)(const weight_t*, const weight_t*, const weight_t*, const weight_t*)
+      = set.outputLayer;
+
+    checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < calls; i++) {
+      const Color stm = Color(i & 1);
+      const int bucket = (i >> 1) % OutputBuckets;
+      checksum += outputLayer(acc.colors[stm], acc.colors[~stm],
+                              weights[bucket], weights[bucket] + HiddenWidth);
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / calls;
+  }
+
+#if defined(USE_DISPATCH)
+
+  // The widest set the CPU can run. vpdpwssd is not always faster than madd + add,
+  // it depends on the CPU and even on the build, so a VNNI set is only kept if its
+  // output layer beats the plain one in a short timing run
+  KernelSet pickKernels() {
+    const std::vector<KernelSet> sets = availableKernels();
+
+    if (!std::strstr(sets[0].name, "vnni"))
+      return sets[0];
+
+    // Only the speed matters, the values of the accumulator don't
+    Accumulator* acc = new Accumulator;
+    memset(acc->both, 0, sizeof(acc->both));
+
+    const OutputWeights& weights = outputWeights();
+
+    // Alternate the sets over a few rounds and keep the best time of each, to filter out noise
+    double best[2] = { 1e30, 1e30 };
+    int checksum;
+
+    for (int round = 0; round < 5; round++)
+      for (int i = 0; i < 2; i++)
+        best[i] = std::min(best[i], outputLayerTime(sets[i], *acc, weights, 10000, checksum));
+
+    delete acc;
+
+    return best[0] < best[1] ? sets[0] : sets[1];
+  }
+
+#endif
+
+  void init() {
+
+    load("", false);
+
+#if defined(USE_DISPATCH)
+    kernels = pickKernels();
+#endif
+  }
+
+  const char* simdName() {
+    return kernels.name;
+  }
+
+  uint64_t networkHash() {
+    return network->hash;
+  }
+
+  NetworkMemory networkMemory() {
+    NetworkMemory mem;
+    mem.weights = NetworkBytes;
+    mem.outputWeights = network->outputWeights.load() ? sizeof(OutputWeights) : 0;
+    mem.placement = network->shared  ? "shared memory"
+                  : network->mapping ? "file mapping"
+                  : network->copy    ? "private copy"
+                  :                    "embedded";
+    return mem;
+  }
+
+  uint64_t networkGeneration() {
+    return generation;
   }
 
   Score evaluate(Position& pos, Accumulator& accumulator) {
@@ -181,37 +693,81 @@ namespace NNUE {
     constexpr int divisor = (32 + OutputBuckets - 1) / OutputBuckets;
     int outputBucket = (BitCount(pos.pieces()) - 2) / divisor;
 
-    Vec* stmAcc = (Vec*) accumulator.colors[pos.sideToMove];
-    Vec* oppAcc = (Vec*) accumulator.colors[~pos.sideToMove];
+    const weight_t* weights = outputWeights()[outputBucket];
 
-    Vec* stmWeights = (Vec*) &NewOutputWeights[outputBucket][0];
-    Vec* oppWeights = (Vec*) &NewOutputWeights[outputBucket][HiddenWidth];
+    const int sum = kernels.outputLayer(accumulator.colors[pos.sideToMove],
+                                        accumulator.colors[~pos.sideToMove],
+                                        weights, weights + HiddenWidth);
 
-    const Vec vecZero = vecSetZero();
-    const Vec vecQA = vecSet1Epi16(NetworkQA);
+    int unsquared = sum / NetworkQA + network->content->OutputBias[outputBucket];
 
-    Vec sum = vecSetZero();
-    Vec v0, v1;
+    return (unsquared * NetworkScale) / NetworkQAB;
+  }
 
-    for (int i = 0; i < HiddenWidth / WeightsPerVec; ++i) {
-      // Side to move
-      v0 = maxEpi16(stmAcc[i], vecZero); // clip
-      v0 = minEpi16(v0, vecQA); // clip
-      v1 = mulloEpi16(v0, stmWeights[i]); // square
-      v1 = maddEpi16(v1, v0); // multiply with output layer
-      sum = addEpi32(sum, v1); // collect the result
+  // Index of the finny table entry used by a side
+  inline int finnyIndex(Position& pos, Color side) {
+    const Square king = pos.kingSquare(side);
+    return (fileOf(king) >= FILE_E) * KingBucketsCount + KingBucketsScheme[relative_square(side, king)];
+  }
 
-      // Non side to move
-      v0 = maxEpi16(oppAcc[i], vecZero);
-      v0 = minEpi16(v0, vecQA);
-      v1 = mulloEpi16(v0, oppWeights[i]);
-      v1 = maddEpi16(v1, v0);
-      sum = addEpi32(sum, v1);
+  void evaluateBatch(Position* positions, int count, Score* scores) {
+    struct BatchState {
+      FinnyTable finny;
+      Accumulator acc;
+    };
+
+    std::unique_ptr<BatchState> state(new BatchState);
+    for (int i = 0; i < 2; i++)
+      for (int j = 0; j < KingBucketsCount; j++)
+        state->finny[i][j].reset();
+
+    // Go through the positions grouped by the king buckets of both sides. Each finny entry then
+    // gets long runs of positions, with only a few pieces differing from one to the next, and the
+    // feature rows it reads stay in cache. The sort is stable so that games keep their move order
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++)
+      order[i] = i;
+
+    std::vector<int> key(count);
+    for (int i = 0; i < count; i++)
+      key[i] = finnyIndex(positions[i], WHITE) * 2 * KingBucketsCount + finnyIndex(positions[i], BLACK);
+
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return key[a] < key[b]; });
+
+    for (int i : order) {
+      refreshFromFinny(state->finny, positions[i], state->acc, WHITE);
+      refreshFromFinny(state->finny, positions[i], state->acc, BLACK);
+      scores[i] = evaluate(positions[i], state->acc);
     }
+  }
 
-    int unsquared = vecHaddEpi32(sum) / NetworkQA + Content.OutputBias[outputBucket];
+  void benchOutputLayer(Position& pos) {
+    constexpr int Calls = 2000000;
 
-    return (unsquared * NetworkScale) / NetworkQAB;
+    Accumulator* acc = new Accumulator;
+    acc->refresh(pos, WHITE);
+    acc->refresh(pos, BLACK);
+
+    const OutputWeights& weights = outputWeights();
+
+    bool first = true;
+    int expected = 0;
+
+    for (const KernelSet& set : availableKernels()) {
+      int checksum;
+      const double time = outputLayerTime(set, *acc, weights, Calls, checksum);
+
+      std::cout << "info string " << set.name << ": " << time
+                << " ns per call, checksum " << checksum
+                << (!first && checksum != expected ? " (MISMATCH)" : "")
+                << (set.outputLayer == kernels.outputLayer ? " (in use)" : "") << std::endl;
+
+      if (first)
+        expected = checksum;
+      first = false;
+    }
+
+    delete acc;
   }
 
 }
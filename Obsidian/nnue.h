@@ -3,6 +3,8 @@
 #include "simd.h"
 #include "types.h"
 
+#include <string>
+
 #define EvalFile "supernet.bin"
 
 using namespace SIMD;
@@ -54,9 +56,15 @@ namespace NNUE {
       alignas(Alignment) weight_t both[COLOR_NB * HiddenWidth];
     };
 
-    void addPiece(Square kingSq, Color side, Piece pc, Square sq);
+    // In a stack of accumulators, the changes from the previous one. Used to update
+    // this accumulator lazily, only when it's needed for an evaluation
+    DirtyPieces dirtyPieces;
+    Square kings[COLOR_NB];
+    bool updated[COLOR_NB];
 
-    void removePiece(Square kingSq, Color side, Piece pc, Square sq);
+    // Apply many additions and removals at once, reading and writing the accumulator only once
+    void addRemovePieces(Square kingSq, Color side, const SquarePiece* adds, int addCount,
+                         const SquarePiece* removes, int removeCount);
 
     void doUpdates(Square kingSq, Color side, DirtyPieces& dp, Accumulator& input);
 
@@ -75,9 +83,51 @@ namespace NNUE {
 
   using FinnyTable = FinnyEntry[2][KingBucketsCount];
 
+  /// Refresh the accumulator of one side from the finny table entry of its king bucket,
+  /// applying only the differences between that entry and the position
+  void refreshFromFinny(FinnyTable& finny, Position& pos, Accumulator& acc, Color side);
+
   bool needRefresh(Color side, Square oldKing, Square newKing);
 
   void init();
 
+  /// Switch to the network in the given file, or to the embedded one if path is empty.
+  /// Files must end with the checksum of the weights, see signNetwork.
+  /// With shared, the weights are placed in (or taken from) a POSIX shared memory segment,
+  /// common to all the engine processes on the host using the same network.
+  /// On failure, prints the reason and keeps the current network
+  bool load(const std::string& path, bool shared);
+
+  /// Write the network in input to output, followed by the 8 byte checksum which
+  /// load requires of network files
+  void signNetwork(const std::string& input, const std::string& output);
+
+  /// The instruction set the NNUE kernels were built for (or picked at startup)
+  const char* simdName();
+
+  /// A hash of the network weights, identifying the network in use
+  uint64_t networkHash();
+
+  /// Changes every time a network is loaded. Anything computed from the weights, like
+  /// finny tables, is stale once this changes
+  uint64_t networkGeneration();
+
+  struct NetworkMemory {
+    size_t weights, outputWeights;
+    // Where the weights are: embedded in the binary, a file mapping, shared memory or a private copy
+    const char* placement;
+  };
+
+  NetworkMemory networkMemory();
+
   Score evaluate(Position& pos, Accumulator& accumulator);
+
+  /// Evaluate many positions at once, writing the score of positions[i] (relative to the side
+  /// to move) into scores[i]. Single threaded, call it on separate slices to use more threads.
+  /// The positions must be valid, with one king per side
+  void evaluateBatch(Position* positions, int count, Score* scores);
+
+  /// Time the output layer of every instruction set this binary can run on this CPU,
+  /// and check they all agree
+  void benchOutputLayer(Position& pos);
 }
\ No newline at end of file
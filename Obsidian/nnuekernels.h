@@ -0,0 +1,135 @@
+// NNUE kernels, written against the vector functions of simd.h.
+// No include guard: nnue.cpp includes this once per instruction set, each time inside
+// a namespace which brings the matching SIMD::<set> functions into scope
+
+constexpr int WeightsPerVec = sizeof(Vec) / sizeof(weight_t);
+
+inline void multiSubAdd(weight_t* output, const weight_t* input, const weight_t* sub0, const weight_t* add0) {
+  const Vec* inputVec = (const Vec*) input;
+  Vec* outputVec = (Vec*)output;
+
+  const Vec* sub0Vec = (const Vec*) sub0;
+  const Vec* add0Vec = (const Vec*) add0;
+
+  for (int i = 0; i < HiddenWidth / WeightsPerVec; ++i)
+    outputVec[i] = subEpi16(addEpi16(inputVec[i], add0Vec[i]), sub0Vec[i]);
+}
+
+inline void multiSubAddSub(weight_t* output, const weight_t* input,
+                           const weight_t* sub0, const weight_t* add0, const weight_t* sub1) {
+  const Vec* inputVec = (const Vec*) input;
+  Vec* outputVec = (Vec*)output;
+
+  const Vec* sub0Vec = (const Vec*) sub0;
+  const Vec* add0Vec = (const Vec*) add0;
+  const Vec* sub1Vec = (const Vec*) sub1;
+
+  for (int i = 0; i < HiddenWidth / WeightsPerVec; ++i)
+    outputVec[i] = subEpi16(subEpi16(addEpi16(inputVec[i], add0Vec[i]), sub0Vec[i]), sub1Vec[i]);
+}
+
+inline void multiSubAddSubAdd(weight_t* output, const weight_t* input,
+                              const weight_t* sub0, const weight_t* add0, const weight_t* sub1, const weight_t* add1) {
+  const Vec* inputVec = (const Vec*) input;
+  Vec* outputVec = (Vec*)output;
+
+  const Vec* sub0Vec = (const Vec*) sub0;
+  const Vec* add0Vec = (const Vec*) add0;
+  const Vec* sub1Vec = (const Vec*) sub1;
+  const Vec* add1Vec = (const Vec*) add1;
+
+  for (int i = 0; i < HiddenWidth / WeightsPerVec; ++i)
+    outputVec[i] = addEpi16(subEpi16(subEpi16(addEpi16(inputVec[i], add0Vec[i]), sub0Vec[i]), sub1Vec[i]), add1Vec[i]);
+}
+
+// The largest count of registers (not more than we have) which divides the accumulator
+constexpr int bestTileRegisters() {
+  constexpr int vecCount = HiddenWidth / WeightsPerVec;
+  for (int regs = NumRegisters; regs > 1; regs--)
+    if (vecCount % regs == 0)
+      return regs;
+  return 1;
+}
+
+constexpr int TileRegisters = bestTileRegisters();
+constexpr int TileSize = TileRegisters * WeightsPerVec;
+
+// Apply any number of feature additions and subtractions to input, writing into output.
+// Each tile of the accumulator is loaded into registers once, gets all the deltas, and is stored once
+inline void multiAddSub(weight_t* output, const weight_t* input,
+                        const weight_t* const* adds, int addCount, const weight_t* const* subs, int subCount)
+{
+  for (int tile = 0; tile < HiddenWidth; tile += TileSize) {
+    Vec regs[TileRegisters];
+
+    const Vec* inputVec = (const Vec*) &input[tile];
+    for (int i = 0; i < TileRegisters; i++)
+      regs[i] = inputVec[i];
+
+    for (int a = 0; a < addCount; a++) {
+      const Vec* addVec = (const Vec*) &adds[a][tile];
+      for (int i = 0; i < TileRegisters; i++)
+        regs[i] = addEpi16(regs[i], addVec[i]);
+    }
+
+    for (int s = 0; s < subCount; s++) {
+      const Vec* subVec = (const Vec*) &subs[s][tile];
+      for (int i = 0; i < TileRegisters; i++)
+        regs[i] = subEpi16(regs[i], subVec[i]);
+    }
+
+    Vec* outputVec = (Vec*) &output[tile];
+    for (int i = 0; i < TileRegisters; i++)
+      outputVec[i] = regs[i];
+  }
+}
+
+// Squared clipped relu of both accumulators, dotted with the output weights.
+// Returns the sum, still scaled by QA * QA * QB
+inline int outputLayer(const weight_t* stm, const weight_t* opp,
+                       const weight_t* stmWeights, const weight_t* oppWeights)
+{
+  const Vec* stmAcc = (const Vec*) stm;
+  const Vec* oppAcc = (const Vec*) opp;
+
+  const Vec* stmWeightsVec = (const Vec*) stmWeights;
+  const Vec* oppWeightsVec = (const Vec*) oppWeights;
+
+  const Vec vecZero = vecSetZero();
+  const Vec vecQA = vecSet1Epi16(NetworkQA);
+
+  // Four independent sums, so that the latency of the multiply add (5 cycles for vpdpwssd)
+  // doesn't serialize the loop. Integer addition is associative, the result is the same
+  constexpr int Chains = 4;
+  static_assert(HiddenWidth / WeightsPerVec % (Chains / 2) == 0);
+
+  Vec sums[Chains];
+  for (int c = 0; c < Chains; c++)
+    sums[c] = vecSetZero();
+
+  Vec v0, v1;
+
+  for (int i = 0; i < HiddenWidth / WeightsPerVec; i += Chains / 2) {
+    for (int j = 0; j < Chains / 2; j++) {
+      // Side to move
+      v0 = maxEpi16(stmAcc[i + j], vecZero); // clip
+      v0 = minEpi16(v0, vecQA); // clip
+      v1 = mulloEpi16(v0, stmWeightsVec[i + j]); // square
+      sums[2 * j] = dpwssdEpi32(sums[2 * j], v1, v0); // multiply with output layer and collect the result
+
+      // Non side to move
+      v0 = maxEpi16(oppAcc[i + j], vecZero);
+      v0 = minEpi16(v0, vecQA);
+      v1 = mulloEpi16(v0, oppWeightsVec[i + j]);
+      sums[2 * j + 1] = dpwssdEpi32(sums[2 * j + 1], v1, v0);
+    }
+  }
+
+  const Vec sum = addEpi32(addEpi32(sums[0], sums[1]), addEpi32(sums[2], sums[3]));
+
+  return vecHaddEpi32(sum);
+}
+
+constexpr KernelSet Kernels = {
+  multiSubAdd, multiSubAddSub, multiSubAddSubAdd, multiAddSub, outputLayer, Name
+};
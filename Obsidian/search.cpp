@@ -9,8 +9,11 @@
 #include "tuning.h"
 #include "uci.h"
 
+#include <atomic>
+#include <cassert>
 #include <climits>
 #include <cmath>
+#include <map>
 #include <sstream>
 
 namespace Search {
@@ -61,6 +64,59 @@ namespace Search {
   
   bool doingBench = false;
 
+  bool recordVisits = false;
+
+  // Helpers skip some iterations, so that they don't all search the same depth at the same time.
+  // With skip sizes up to maxSize ('SMP Skip Depths'), there are 2 * size schedules of each size,
+  // one per phase. Helper i (from 1) follows schedule (i - 1) % (maxSize * (maxSize + 1)), and
+  // searches a depth only when (depth + phase) / size is even. A max size of 4 gives the
+  // classic table of 20 schedules
+  void skipSchedule(int helper, int maxSize, int& size, int& phase) {
+    int schedule = (helper - 1) % (maxSize * (maxSize + 1));
+
+    for (size = 1; schedule >= 2 * size; size++)
+      schedule -= 2 * size;
+
+    phase = schedule;
+  }
+
+  // A lossy, lockless table of the children being searched right now by any thread, in the
+  // spirit of ABDADA. A slot holds the key of a child xored with a hash of its parent's depth,
+  // or 0 when free. A thread which finds a late move busy searches it after the other moves
+  namespace SearchingTable {
+
+    constexpr int Size = 1 << 16;
+    constexpr int MinDepth = 6;
+
+    // Moves deferred by a node at most, the next busy ones are searched in order.
+    // Small, as the list is on the stack of every node
+    constexpr int MaxDeferred = 8;
+
+    std::atomic<Key> slots[Size];
+
+    inline Key tag(Key childKey, int depth) {
+      return childKey ^ (uint64_t(depth) * 0x9E3779B97F4A7C15ULL);
+    }
+
+    inline std::atomic<Key>& slot(Key tag) {
+      return slots[tag & (Size - 1)];
+    }
+
+    inline bool isBusy(Key tag) {
+      return slot(tag).load(std::memory_order_relaxed) == tag;
+    }
+
+    // Returns false if the slot is taken, by this child or another one
+    inline bool mark(Key tag) {
+      Key expected = 0;
+      return slot(tag).compare_exchange_strong(expected, tag, std::memory_order_relaxed);
+    }
+
+    inline void unmark(Key tag) {
+      slot(tag).store(0, std::memory_order_relaxed);
+    }
+  }
+
   int lmrTable[MAX_PLY][MAX_MOVES];
 
   Settings::Settings() {
@@ -125,10 +181,27 @@ namespace Search {
     previousScore = SCORE_NONE;
   }
 
-  Thread::Thread() :
+  void Thread::clearQsCache() {
+    std::fill(qsCache.begin(), qsCache.end(), TT::Entry());
+  }
+
+  MemoryUsage Thread::memoryUsage() const {
+    MemoryUsage usage;
+    usage.histories = sizeof(mainHistory) + sizeof(captureHistory) + sizeof(contHistory) + sizeof(counterMoveHistory);
+    usage.finny = sizeof(finny);
+    usage.accumulators = accumStack.capacity() * sizeof(NNUE::Accumulator);
+    usage.caches = qsCache.capacity() * sizeof(TT::Entry) + evalCache.capacity() * sizeof(EvalCacheEntry);
+    usage.total = sizeof(Thread) + usage.accumulators + usage.caches;
+    return usage;
+  }
+
+  Thread::Thread(int idx) :
+    idx(idx),
     thread(std::thread(&Thread::idleLoop, this))
   {
-    resetHistories();
+    // Histories are cleared later, by the thread itself
+    ttStats = TT::Stats();
+    evalCacheStats = EvalCacheStats();
   }
 
   template<bool root>
@@ -223,32 +296,65 @@ namespace Search {
     keyStackHead--;
   }
 
-  void Thread::refreshAccumulator(Position& pos, NNUE::Accumulator& acc, Color side) {
-    const Square king = pos.kingSquare(side);
-    const int bucket = NNUE::KingBucketsScheme[relative_square(side, king)];
-    NNUE::FinnyEntry& entry = finny[fileOf(king) >= FILE_E][bucket];
-
-    for (Color c = WHITE; c <= BLACK; ++c) {
-      for (PieceType pt = PAWN; pt <= KING; ++pt) {
-        const Bitboard oldBB = entry.byColorBB[side][c] & entry.byPieceBB[side][pt];
-        const Bitboard newBB = pos.pieces(c, pt);
-        Bitboard toRemove = oldBB & ~newBB;
-        Bitboard toAdd = newBB & ~oldBB;
-
-        while (toRemove) {
-          Square sq = popLsb(toRemove);
-          entry.acc.removePiece(king, side, makePiece(c, pt), sq);
-        }
-        while (toAdd) {
-          Square sq = popLsb(toAdd);
-          entry.acc.addPiece(king, side, makePiece(c, pt), sq);
-        }
+  TT::Entry* Thread::probeQsCache(Key key, bool& hit, TT::Entry& ttData) {
+    using uint128 = unsigned __int128;
+    TT::Entry* entry = &qsCache[(uint128(key) * uint128(qsCache.size())) >> 64];
+
+    ttData = *entry;
+    hit = ttData.matches(key) && !ttData.isEmpty();
+    return entry;
+  }
+
+  void Thread::growAccumStack() {
+    accumStack.resize(std::min<size_t>(accumStack.size() * 2, MAX_PLY + 1));
+  }
+
+  void Thread::updateAccumulator(Position& pos, Color side) {
+    NNUE::Accumulator& acc = accumStack[accumStackHead];
+
+    // Look for the last updated accumulator. If the king changed bucket on the way,
+    // the changes can't be applied incrementally, so refresh this one instead
+    int last = accumStackHead;
+    while (!accumStack[last].updated[side]) {
+      if (NNUE::needRefresh(side, accumStack[last - 1].kings[side], accumStack[last].kings[side])) {
+        NNUE::refreshFromFinny(finny, pos, acc, side);
+        acc.updated[side] = true;
+        return;
       }
+      last--;
     }
 
-    memcpy(acc.colors[side], entry.acc.colors[side], sizeof(acc.colors[0]));
-    memcpy(entry.byColorBB[side], pos.byColorBB, sizeof(entry.byColorBB[0]));
-    memcpy(entry.byPieceBB[side], pos.byPieceBB, sizeof(entry.byPieceBB[0]));
+    for (int i = last + 1; i <= accumStackHead; i++) {
+      accumStack[i].doUpdates(accumStack[i].kings[side], side, accumStack[i].dirtyPieces, accumStack[i - 1]);
+      accumStack[i].updated[side] = true;
+    }
+  }
+
+  Score Thread::evaluate(Position& pos) {
+    using uint128 = unsigned __int128;
+    EvalCacheEntry* entry = nullptr;
+
+    // The index comes from the high bits of the key, the stored key from the low ones.
+    // On a hit the accumulators are not even updated, they stay lazy
+    if (!evalCache.empty()) {
+      entry = &evalCache[(uint128(pos.key) * uint128(evalCache.size())) >> 64];
+      evalCacheStats.probes++;
+
+      if (entry->key == uint32_t(pos.key)) {
+        evalCacheStats.hits++;
+        return Eval::adjust(pos, entry->nnueScore);
+      }
+    }
+
+    updateAccumulator(pos, WHITE);
+    updateAccumulator(pos, BLACK);
+
+    const Score nnueScore = NNUE::evaluate(pos, accumStack[accumStackHead]);
+
+    if (entry)
+      *entry = { uint32_t(pos.key), nnueScore };
+
+    return Eval::adjust(pos, nnueScore);
   }
 
   void Thread::playMove(Position& pos, Move move, SearchInfo* ss) {
@@ -260,26 +366,20 @@ namespace Search {
     ss->playedMove = move;
     keyStack[keyStackHead++] = pos.key;
 
-    Square oldKingSquares[COLOR_NB];
-    oldKingSquares[WHITE] = pos.kingSquare(WHITE);
-    oldKingSquares[BLACK] = pos.kingSquare(BLACK);
-
-    NNUE::Accumulator& oldAcc = accumStack[accumStackHead];
-    NNUE::Accumulator& newAcc = accumStack[++accumStackHead];
+    if (++accumStackHead == int(accumStack.size()))
+      growAccumStack();
 
-    DirtyPieces dirtyPieces;
+    NNUE::Accumulator& newAcc = accumStack[accumStackHead];
 
     ply++;
-    pos.doMove(move, dirtyPieces);
+    pos.doMove(move, newAcc.dirtyPieces);
 
     TT::prefetch(pos.key);
 
-    for (Color side = WHITE; side <= BLACK; ++side) {
-      if (NNUE::needRefresh(side, oldKingSquares[side], pos.kingSquare(side)))
-        refreshAccumulator(pos, newAcc, side);
-      else
-        newAcc.doUpdates(pos.kingSquare(side), side, dirtyPieces, oldAcc); 
-    }
+    // Many nodes are never evaluated (TT cutoffs, draws, ...), so only remember what changed
+    newAcc.kings[WHITE] = pos.kingSquare(WHITE);
+    newAcc.kings[BLACK] = pos.kingSquare(BLACK);
+    newAcc.updated[WHITE] = newAcc.updated[BLACK] = false;
   }
 
   void Thread::cancelMove() {
@@ -412,18 +512,32 @@ namespace Search {
 
   template<bool IsPV>
   Score Thread::qsearch(Position& pos, Score alpha, Score beta, int depth, SearchInfo* ss) {
-    
+
+    if constexpr (RecordVisits)
+      if (recordVisits)
+        visitedKeys.push_back(pos.key);
+
     // Quit if we are close to reaching max ply
     if (ply >= MAX_PLY-4)
-      return pos.checkers ? SCORE_DRAW : Eval::evaluate(pos, accumStack[accumStackHead]);
+      return pos.checkers ? SCORE_DRAW : evaluate(pos);
 
     // Detect draw
     if (isRepetition(pos, ply) || pos.halfMoveClock >= 100)
       return SCORE_DRAW;
 
-    // Probe TT
+    // Probe TT. If we have a qsearch cache, we store there, and only read the shared table
+    // when the cache misses, without writing to it
     bool ttHit;
-    TT::Entry* ttEntry = TT::probe(pos.key, ttHit);
+    TT::Entry ttData;
+    TT::Entry* ttEntry;
+
+    if (qsCache.empty())
+      ttEntry = TT::probe(pos.key, ttHit, ttData);
+    else {
+      ttEntry = probeQsCache(pos.key, ttHit, ttData);
+      if (!ttHit)
+        ttHit = TT::peek(pos.key, ttData);
+    }
     TT::Flag ttBound = TT::NO_FLAG;
     Score ttScore = SCORE_NONE;
     Move ttMove = MOVE_NONE;
@@ -431,11 +545,11 @@ namespace Search {
     bool ttPV = false;
 
     if (ttHit) {
-      ttBound = ttEntry->getBound();
-      ttScore = ttEntry->getScore(ply);
-      ttMove = ttEntry->getMove();
-      ttStaticEval = ttEntry->getStaticEval();
-      ttPV = ttEntry->wasPV();
+      ttBound = ttData.getBound();
+      ttScore = ttData.getScore(ply);
+      ttMove = ttData.getMove();
+      ttStaticEval = ttData.getStaticEval();
+      ttPV = ttData.wasPV();
     }
 
     // In non PV nodes, if tt bound allows it, return ttScore
@@ -459,7 +573,7 @@ namespace Search {
       if (ttStaticEval != SCORE_NONE)
         bestScore = ss->staticEval = ttStaticEval;
       else
-        bestScore = ss->staticEval = Eval::evaluate(pos, accumStack[accumStackHead]);
+        bestScore = ss->staticEval = evaluate(pos);
 
       futility = bestScore + QsFpMargin;
 
@@ -582,15 +696,13 @@ namespace Search {
 
     const bool IsRoot = IsPV && ply == 0;
 
-    // Check time
-    ++maxTimeCounter;
-    if ( this == Threads::mainThread() 
-      && (maxTimeCounter & 16383) == 0
-      && usedMostOfTime())
-        Threads::stopSearch();
-
+    // The hard time limit is enforced by the timer thread (see Threads::setDeadline)
     if (Threads::isSearchStopped())
       return SCORE_DRAW;
+
+    if constexpr (RecordVisits)
+      if (recordVisits)
+        visitedKeys.push_back(pos.key);
     
     // Init node
     if (IsPV)
@@ -613,7 +725,7 @@ namespace Search {
 
     // Quit if we are close to reaching max ply
     if (ply >= MAX_PLY - 4)
-      return pos.checkers ? SCORE_DRAW : Eval::evaluate(pos, accumStack[accumStackHead]);
+      return pos.checkers ? SCORE_DRAW : evaluate(pos);
 
     // Mate distance pruning
     alpha = std::max(alpha, ply - SCORE_MATE);
@@ -623,7 +735,8 @@ namespace Search {
 
     // Probe TT
     bool ttHit;
-    TT::Entry* ttEntry = TT::probe(pos.key, ttHit);
+    TT::Entry ttData;
+    TT::Entry* ttEntry = TT::probe(pos.key, ttHit, ttData);
 
     TT::Flag ttBound = TT::NO_FLAG;
     Score ttScore   = SCORE_NONE;
@@ -633,12 +746,12 @@ namespace Search {
     bool ttPV = IsPV;
 
     if (ttHit) {
-      ttBound = ttEntry->getBound();
-      ttScore = ttEntry->getScore(ply);
-      ttMove = ttEntry->getMove();
-      ttDepth = ttEntry->getDepth();
-      ttStaticEval = ttEntry->getStaticEval();
-      ttPV |= ttEntry->wasPV();
+      ttBound = ttData.getBound();
+      ttScore = ttData.getScore(ply);
+      ttMove = ttData.getMove();
+      ttDepth = ttData.getDepth();
+      ttStaticEval = ttData.getStaticEval();
+      ttPV |= ttData.wasPV();
     }
 
     if (IsRoot)
@@ -720,7 +833,7 @@ namespace Search {
       if (ttStaticEval != SCORE_NONE)
         ss->staticEval = eval = ttStaticEval;
       else
-        ss->staticEval = eval = Eval::evaluate(pos, accumStack[accumStackHead]);
+        ss->staticEval = eval = evaluate(pos);
 
       if (! ttHit) {
         // This (probably new) position has just been evaluated.
@@ -852,7 +965,37 @@ namespace Search {
 
     Move move;
 
-    while (move = movePicker.nextMove(skipQuiets)) {
+    // Late moves another thread was searching, visited once the move picker is done
+    Move deferredMoves[SearchingTable::MaxDeferred];
+    int deferredCount = 0, deferredIdx = 0;
+    bool pickerDone = false;
+
+    const bool canDefer = deferBusyMoves && !IsRoot && depth >= SearchingTable::MinDepth;
+
+#if !defined(NDEBUG)
+    // Every move out of the picker must be visited once, or dropped on replay by skipQuiets,
+    // so that deferring changes the order of the moves and nothing else
+    int pickedMoves = 0, replaySkipped = 0;
+#endif
+
+    while (true) {
+      if (!pickerDone && !(move = movePicker.nextMove(skipQuiets)))
+        pickerDone = true;
+
+      if (pickerDone) {
+        if (deferredIdx == deferredCount)
+          break;
+        move = deferredMoves[deferredIdx++];
+
+        // The picker no longer returns quiets once skipQuiets is set, deferred ones included
+        if (skipQuiets && pos.isQuiet(move)) {
+#if !defined(NDEBUG)
+          replaySkipped++;
+#endif
+          continue;
+        }
+      }
+
       if (move == excludedMove)
         continue;
 
@@ -861,6 +1004,25 @@ namespace Search {
 
       if (IsRoot && !visitRootMove(move))
         continue;
+
+#if !defined(NDEBUG)
+      pickedMoves += !pickerDone;
+#endif
+
+      // The first move is always searched, like the eldest son of ABDADA
+      Key searchingTag = 0;
+      if (canDefer) {
+        searchingTag = SearchingTable::tag(pos.keyAfter(move), depth);
+
+        if ( !pickerDone
+          && seenMoves
+          && deferredCount < SearchingTable::MaxDeferred
+          && SearchingTable::isBusy(searchingTag)) {
+          deferredMoves[deferredCount++] = move;
+          deferrals++;
+          continue;
+        }
+      }
       
       seenMoves++;
       
@@ -935,6 +1097,8 @@ namespace Search {
       Position newPos = pos;
       playMove(newPos, move, ss);
 
+      const bool markedSearching = searchingTag && SearchingTable::mark(searchingTag);
+
       int newDepth = depth + extension - 1;
 
       Score score;
@@ -985,6 +1149,9 @@ namespace Search {
       if (IsPV && (seenMoves == 1 || score > alpha))
         score = -negamax<true>(newPos, -beta, -alpha, newDepth, false, ss + 1);
 
+      if (markedSearching)
+        SearchingTable::unmark(searchingTag);
+
       cancelMove();
 
       if (Threads::isSearchStopped())
@@ -1036,6 +1203,8 @@ namespace Search {
       }
     }
 
+    assert(bestScore >= beta || seenMoves + replaySkipped == pickedMoves);
+
     if (!seenMoves) {
       if (excludedMove) 
         return alpha;
@@ -1099,6 +1268,77 @@ namespace Search {
     return output.str();
   }
 
+  void printInfo(int depth, int multiPvIdx, RootMove& rm, clock_t elapsed) {
+    std::ostringstream infoStr;
+    infoStr
+      << "info"
+      << " depth "    << depth
+      << " multipv "  << multiPvIdx
+      << " score "    << UCI::scoreToString(rm.score)
+      << " nodes "    << Threads::totalNodes()
+      << " nps "      << (Threads::totalNodes() * 1000ULL) / std::max(elapsed, 1L)
+      << " hashfull " << TT::hashfull()
+      << " tbhits "   << Threads::totalTbHits()
+      << " time "     << elapsed
+      << " pv "       << getPvString(rm);
+
+    std::cout << infoStr.str() << std::endl;
+  }
+
+  // Each thread votes for its best move, with a weight growing with its completed depth
+  // and with how its score compares to the other threads. Proven wins and losses
+  // override the vote, and the shortest mate is preferred
+  Thread* Thread::pickBestThread() {
+    // Start from a thread with a completed iteration, the root moves of the others can
+    // come from an interrupted one
+    Thread* bestThread = this;
+    for (Thread* th : Threads::searchThreads) {
+      if (th->completedDepth) {
+        bestThread = th;
+        break;
+      }
+    }
+
+    Score minScore = SCORE_INFINITE;
+    for (Thread* th : Threads::searchThreads) {
+      if (th->completedDepth)
+        minScore = std::min(minScore, Score(th->rootMoves[0].score));
+    }
+
+    auto voteWeight = [&](Thread* th) {
+      return int64_t(th->rootMoves[0].score - minScore + 14) * th->completedDepth;
+    };
+
+    std::map<Move, int64_t> votes;
+    for (Thread* th : Threads::searchThreads) {
+      if (th->completedDepth)
+        votes[th->rootMoves[0].move] += voteWeight(th);
+    }
+
+    for (Thread* th : Threads::searchThreads) {
+      if (!th->completedDepth)
+        continue;
+
+      const Score bestScore = bestThread->rootMoves[0].score;
+      const Score newScore = th->rootMoves[0].score;
+      const Move bestMove = bestThread->rootMoves[0].move;
+      const Move newMove = th->rootMoves[0].move;
+
+      if (bestScore >= SCORE_TB_WIN_IN_MAX_PLY) {
+        if (newScore > bestScore)
+          bestThread = th;
+      }
+      else if (newScore >= SCORE_TB_WIN_IN_MAX_PLY)
+        bestThread = th;
+      else if (newScore > SCORE_TB_LOSS_IN_MAX_PLY
+            && (  votes[newMove] > votes[bestMove]
+               || (votes[newMove] == votes[bestMove] && voteWeight(th) > voteWeight(bestThread))))
+        bestThread = th;
+    }
+
+    return bestThread;
+  }
+
   DEFINE_PARAM_B(tm0, 177, 50, 200);
   DEFINE_PARAM_B(tm1, 63,  20, 100);
 
@@ -1118,14 +1358,26 @@ namespace Search {
 
     Position rootPos = settings.position;
 
-    accumStackHead = 0;
-    accumStack[0].refresh(rootPos, WHITE);
-    accumStack[0].refresh(rootPos, BLACK);
-    
-    for (int i = 0; i < 2; i++)
+    // Finny tables stay valid across searches, as long as the network doesn't change
+    if (finnyGeneration != NNUE::networkGeneration()) {
+      for (int i = 0; i < 2; i++)
         for (int j = 0; j < NNUE::KingBucketsCount; j++)
           finny[i][j].reset();
 
+      finnyGeneration = NNUE::networkGeneration();
+    }
+
+    // Allocated here, so the memory is first touched by this thread
+    if (accumStack.empty())
+      accumStack.resize(InitialAccumStackSize);
+
+    accumStackHead = 0;
+    for (Color side = WHITE; side <= BLACK; ++side) {
+      NNUE::refreshFromFinny(finny, rootPos, accumStack[0], side);
+      accumStack[0].kings[side] = rootPos.kingSquare(side);
+      accumStack[0].updated[side] = true;
+    }
+
     keyStackHead = 0;
     for (int i = 0; i < settings.prevPositions.size(); i++)
       keyStack[keyStackHead++] = settings.prevPositions[i];
@@ -1136,10 +1388,27 @@ namespace Search {
     else if (settings.movetime)
       maxTime = settings.movetime - int(Options["Move Overhead"]);
 
+    if ( this == Threads::mainThread()
+      && (settings.standardTimeLimit() || settings.movetime))
+      Threads::setDeadline(settings.startTime + maxTime);
+
     ply = 0;
     tbHits = 0;
     nodesSearched = 0;
-    maxTimeCounter = 0;
+    deferrals = 0;
+
+    TT::threadStats = Options["TT Stats"] ? &ttStats : nullptr;
+
+    // (Re)allocate here, so the memory is first touched by this thread
+    const size_t qsCacheSize = size_t(int(Options["QS Cache"])) * 1024 / sizeof(TT::Entry);
+    if (qsCache.size() != qsCacheSize)
+      qsCache.assign(qsCacheSize, TT::Entry());
+
+    const size_t evalCacheSize = size_t(int(Options["Eval Cache"])) * 1024 / sizeof(EvalCacheEntry);
+    if (evalCache.size() != evalCacheSize || evalCacheGeneration != NNUE::networkGeneration()) {
+      evalCache.assign(evalCacheSize, EvalCacheEntry());
+      evalCacheGeneration = NNUE::networkGeneration();
+    }
 
     SearchLoopInfo idStack[MAX_PLY];
 
@@ -1175,6 +1444,10 @@ namespace Search {
 
     const bool oneLegalMove = (rootMoves.size() == 1);
 
+    // Set when the tablebases picked the only root move. Helpers don't probe the root,
+    // so the move of the main thread must not be outvoted
+    bool tbRootMove = false;
+
     if ( this == Threads::mainThread()
       && BitCount(rootPos.pieces()) <= TB_LARGEST) {
 
@@ -1195,6 +1468,7 @@ namespace Search {
         // For analysis purposes, we don't want to instantly just print the move (though we could)
         rootMoves = RootMoveList();
         rootMoves.add(tbBestMove);
+        tbRootMove = true;
       }
     }
 
@@ -1204,12 +1478,28 @@ namespace Search {
 
     const int multiPV = std::min(int(Options["MultiPV"]), rootMoves.size());
 
+    completedDepth = 0;
+
+    deferBusyMoves = Threads::searchThreads.size() > 1 && Options["SMP Defer Moves"];
+
+    const int maxSkipSize = idx > 0 ? int(Options["SMP Skip Depths"]) : 0;
+    int skipSize = 1, skipPhase = 0;
+
+    if (maxSkipSize)
+      skipSchedule(idx, maxSkipSize, skipSize, skipPhase);
+
+    if constexpr (RecordVisits)
+      visitedKeys.clear();
+
     for (rootDepth = 1; rootDepth <= settings.depth; rootDepth++) {
 
       // Only one legal move? For analysis purposes search, but with a limited depth
       if (rootDepth > 10 && oneLegalMove)
         break;
 
+      if (maxSkipSize && ((rootDepth + skipPhase) / skipSize) % 2)
+        continue;
+
       for (pvIdx = 0; pvIdx < multiPV; pvIdx++) {
         int window = AspWindowStartDelta;
         Score alpha = -SCORE_INFINITE;
@@ -1259,6 +1549,8 @@ namespace Search {
         sortRootMoves(0);
       }
 
+      completedDepth = rootDepth;
+
       const Move bestMove = rootMoves[0].move;
       const Score score = rootMoves[0].score;
 
@@ -1274,20 +1566,7 @@ namespace Search {
         if (doingBench)
           break; // save indentation
 
-        std::ostringstream infoStr;
-        infoStr
-          << "info"
-          << " depth "    << rootDepth
-          << " multipv "  << (i+1)
-          << " score "    << UCI::scoreToString(rootMoves[i].score)
-          << " nodes "    << Threads::totalNodes()
-          << " nps "      << (Threads::totalNodes() * 1000ULL) / std::max(elapsed, 1L)
-          << " hashfull " << TT::hashfull()
-          << " tbhits "   << Threads::totalTbHits()
-          << " time "     << elapsed
-          << " pv "       << getPvString(rootMoves[i]);
-
-        std::cout << infoStr.str() << std::endl;
+        printInfo(rootDepth, i + 1, rootMoves[i], elapsed);
       }
 
       if (usedMostOfTime())
@@ -1318,16 +1597,32 @@ namespace Search {
 
   bestMoveDecided:
 
-    // NOTE: When implementing best thread selection, don't mess up with tablebases dtz stuff
-
     if (this != Threads::mainThread())
       return;
 
     Threads::stopSearch();
-    
+    Threads::clearDeadline();
+
+    // Helpers must be done before their root moves can be read
+    for (int i = 1; i < Threads::searchThreads.size(); i++) {
+      Thread* st = Threads::searchThreads[i];
+      std::unique_lock lock(st->mutex);
+      st->cv.wait(lock, [&] { return !st->searching; });
+    }
+
+    Thread* bestThread = this;
+
+    if (Threads::searchThreads.size() > 1 && multiPV == 1 && !tbRootMove)
+      bestThread = pickBestThread();
+
+    RootMove& bestRootMove = bestThread->rootMoves[0];
+
     if (!doingBench) {
-      previousScore = rootMoves[0].score;
-      std::cout << "bestmove " << UCI::moveToString(rootMoves[0].move) << std::endl;
+      if (bestThread != this)
+        printInfo(bestThread->completedDepth, 1, bestRootMove, elapsedTime());
+
+      previousScore = bestRootMove.score;
+      std::cout << "bestmove " << UCI::moveToString(bestRootMove.move) << std::endl;
     }
   }
 
@@ -1340,7 +1635,13 @@ namespace Search {
           return;
 
    // searching = true; (already done by the UCI thread)
-      startSearch();
+      if (task) {
+        task();
+        task = nullptr;
+      }
+      else
+        startSearch();
+
       searching = false;
 
       cv.notify_all();
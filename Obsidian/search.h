@@ -3,15 +3,28 @@
 #include "history.h"
 #include "nnue.h"
 #include "position.h"
+#include "tt.h"
 #include "types.h"
 
+#include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <vector>
 
 namespace Search {
 
   extern bool doingBench;
 
+  // Build with -DRECORD_VISITS for smpbench to report the share of unique nodes.
+  // Then while recordVisits is set, every thread records the key of each node it searches in visitedKeys
+#if defined(RECORD_VISITS)
+  constexpr bool RecordVisits = true;
+#else
+  constexpr bool RecordVisits = false;
+#endif
+
+  extern bool recordVisits;
+
   struct Settings {
 
     clock_t time[COLOR_NB], inc[COLOR_NB], movetime, startTime;
@@ -46,9 +59,27 @@ namespace Search {
     int doubleExt;
 
     // [piece to]
-    int* contHistory;
+    HistoryValue* contHistory;
+  };
+
+  constexpr size_t CacheLineSize = 64;
+
+  struct EvalCacheEntry {
+    uint32_t key;
+    Score nnueScore;
+  };
+
+  struct EvalCacheStats {
+    RelaxedCounter probes, hits;
   };
 
+  struct MemoryUsage {
+    size_t histories, finny, accumulators, caches, total;
+  };
+
+  // Accumulators allocated for a search at first. The stack doubles when a search goes deeper
+  constexpr int InitialAccumStackSize = 32;
+
   // A sort of header of the search stack, so that plies behind 0 are accessible and
   // it's easier to determine conthist score, improving, ...
   constexpr int SsOffset = 6;
@@ -57,6 +88,9 @@ namespace Search {
 
   public:
 
+    // Index in Threads::searchThreads, 0 for the main thread
+    const int idx;
+
     std::mutex mutex;
     std::condition_variable cv;
 
@@ -64,17 +98,37 @@ namespace Search {
     volatile bool exitThread = false;
     std::thread thread;
 
-    uint64_t nodesSearched;
-    uint64_t tbHits;
+    // When set, the thread runs this on its next wake up, instead of searching
+    std::function<void()> task;
+
+    // Counted at every node and read by other threads, so they get a cache line of their own,
+    // away from the fields above which the UCI and main threads touch
+    alignas(CacheLineSize) RelaxedCounter nodesSearched;
+    RelaxedCounter tbHits;
+
+    // Late moves put off to the end of their move loop, because another thread was searching them
+    RelaxedCounter deferrals;
+
+    alignas(CacheLineSize) TT::Stats ttStats;
 
-    Thread();
+    EvalCacheStats evalCacheStats;
+
+    // The last iteration of this search which was not interrupted, 0 if none
+    int completedDepth;
+
+    std::vector<Key> visitedKeys;
+
+    Thread(int idx);
 
     void resetHistories();
+
+    void clearQsCache();
+
+    MemoryUsage memoryUsage() const;
     
   private:
     
     clock_t optimumTime, maxTime;
-    uint32_t maxTimeCounter;
 
     int rootDepth;
 
@@ -84,7 +138,7 @@ namespace Search {
     Key keyStack[100 + MAX_PLY];
 
     int accumStackHead;
-    NNUE::Accumulator accumStack[MAX_PLY];
+    std::vector<NNUE::Accumulator> accumStack;
 
     SearchInfo searchStack[MAX_PLY + SsOffset];
 
@@ -98,9 +152,30 @@ namespace Search {
 
     NNUE::FinnyTable finny;
 
+    // The network generation the finny table was built with, 0 if never built
+    uint64_t finnyGeneration = 0;
+
+    // Optional direct mapped table, private to this thread, which replaces the TT in qsearch.
+    // Off by default: in bench it costs more nodes to reach the same depth than it saves
+    std::vector<TT::Entry> qsCache;
+
+    // Optional direct mapped table of network outputs, in front of evaluate(). Holds the
+    // outputs of the network generation in evalCacheGeneration
+    std::vector<EvalCacheEntry> evalCache;
+    uint64_t evalCacheGeneration = 0;
+
     Score previousScore;
 
-    void refreshAccumulator(Position& pos, NNUE::Accumulator& acc, Color side);
+    // Whether to put off the late moves another thread is searching (see SearchingTable)
+    bool deferBusyMoves;
+
+    TT::Entry* probeQsCache(Key key, bool& hit, TT::Entry& ttData);
+
+    void growAccumStack();
+
+    void updateAccumulator(Position& pos, Color side);
+
+    Score evaluate(Position& pos);
 
     void sortRootMoves(int offset);
 
@@ -108,6 +183,8 @@ namespace Search {
 
     bool usedMostOfTime();
 
+    Thread* pickBestThread();
+
     void playNullMove(Position& pos, SearchInfo* ss);
 
     void cancelNullMove();
@@ -4,12 +4,33 @@
 #include <cstdint>
 #include <immintrin.h>
 
-namespace SIMD {
+// Each instruction set has its own namespace. Normally only the ones enabled by the
+// compiler flags are built, and the best of them is used. With USE_DISPATCH all of them
+// are built (with the matching target attributes), and the NNUE picks one at runtime
+
+#if defined(USE_DISPATCH) || (defined(__AVX512F__) && defined(__AVX512BW__))
+#define SIMD_AVX512
+#endif
+
+#if defined(USE_DISPATCH) || defined(__AVX2__)
+#define SIMD_AVX2
+#endif
+
+#ifdef SIMD_AVX512
+
+#if defined(USE_DISPATCH)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#endif
 
-#if defined(__AVX512F__) && defined(__AVX512BW__)
+namespace SIMD::Avx512 {
+
+  constexpr const char* Name = "avx512";
 
   using Vec = __m512i;
 
+  constexpr int NumRegisters = 32;
+
   inline Vec addEpi16(Vec x, Vec y) {
     return _mm512_add_epi16(x, y);
   }
@@ -38,6 +59,11 @@ namespace SIMD {
     return _mm512_madd_epi16(x, y);
   }
 
+  // sum + maddEpi16(x, y)
+  inline Vec dpwssdEpi32(Vec sum, Vec x, Vec y) {
+    return addEpi32(sum, maddEpi16(x, y));
+  }
+
   inline Vec vecSetZero() {
     return _mm512_setzero_si512();
   }
@@ -49,11 +75,63 @@ namespace SIMD {
   inline int vecHaddEpi32(Vec vec) {
     return _mm512_reduce_add_epi32(vec);
   }
+}
+
+#if defined(USE_DISPATCH)
+#pragma GCC pop_options
+#endif
+
+#endif
+
+#if defined(USE_DISPATCH) || (defined(SIMD_AVX512) && defined(__AVX512VNNI__))
+#define SIMD_AVX512_VNNI
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vnni")
+
+// Same as Avx512, but the multiply add of the output layer is a single vpdpwssd
+namespace SIMD::Avx512Vnni {
+
+  constexpr const char* Name = "avx512vnni";
+
+  using Avx512::Vec;
+  using Avx512::NumRegisters;
+
+  using Avx512::addEpi16;
+  using Avx512::addEpi32;
+  using Avx512::subEpi16;
+  using Avx512::minEpi16;
+  using Avx512::maxEpi16;
+  using Avx512::mulloEpi16;
+  using Avx512::maddEpi16;
+  using Avx512::vecSetZero;
+  using Avx512::vecSet1Epi16;
+  using Avx512::vecHaddEpi32;
+
+  inline Vec dpwssdEpi32(Vec sum, Vec x, Vec y) {
+    return _mm512_dpwssd_epi32(sum, x, y);
+  }
+}
 
-#elif defined(__AVX2__)
+#pragma GCC pop_options
+
+#endif
+
+#ifdef SIMD_AVX2
+
+#if defined(USE_DISPATCH)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace SIMD::Avx2 {
+
+  constexpr const char* Name = "avx2";
 
   using Vec = __m256i;
 
+  constexpr int NumRegisters = 16;
+
   inline Vec addEpi16(Vec x, Vec y) {
     return _mm256_add_epi16(x, y);
   }
@@ -82,6 +160,11 @@ namespace SIMD {
     return _mm256_madd_epi16(x, y);
   }
 
+  // sum + maddEpi16(x, y)
+  inline Vec dpwssdEpi32(Vec sum, Vec x, Vec y) {
+    return addEpi32(sum, maddEpi16(x, y));
+  }
+
   inline Vec vecSetZero() {
     return _mm256_setzero_si256();
   }
@@ -116,11 +199,56 @@ namespace SIMD {
     // Cast the result to the 32-bit integer type and return it:
     return _mm_cvtsi128_si32(xmm0);
   }
+}
 
-#else
+#if defined(USE_DISPATCH)
+#pragma GCC pop_options
+#endif
+
+#endif
+
+#if defined(USE_DISPATCH) || (defined(SIMD_AVX2) && defined(__AVXVNNI__))
+#define SIMD_AVX2_VNNI
+
+#pragma GCC push_options
+#pragma GCC target("avx2,avxvnni")
+
+// Same as Avx2, but the multiply add of the output layer is a single vpdpwssd
+namespace SIMD::Avx2Vnni {
+
+  constexpr const char* Name = "avxvnni";
+
+  using Avx2::Vec;
+  using Avx2::NumRegisters;
+
+  using Avx2::addEpi16;
+  using Avx2::addEpi32;
+  using Avx2::subEpi16;
+  using Avx2::minEpi16;
+  using Avx2::maxEpi16;
+  using Avx2::mulloEpi16;
+  using Avx2::maddEpi16;
+  using Avx2::vecSetZero;
+  using Avx2::vecSet1Epi16;
+  using Avx2::vecHaddEpi32;
+
+  inline Vec dpwssdEpi32(Vec sum, Vec x, Vec y) {
+    return _mm256_dpwssd_avx_epi32(sum, x, y);
+  }
+}
+
+#pragma GCC pop_options
+
+#endif
+
+namespace SIMD::Sse2 {
+
+  constexpr const char* Name = "sse2";
 
   using Vec = __m128i;
 
+  constexpr int NumRegisters = 16;
+
   inline Vec addEpi16(Vec x, Vec y) {
     return _mm_add_epi16(x, y);
   }
@@ -149,6 +277,11 @@ namespace SIMD {
     return _mm_madd_epi16(x, y);
   }
 
+  // sum + maddEpi16(x, y)
+  inline Vec dpwssdEpi32(Vec sum, Vec x, Vec y) {
+    return addEpi32(sum, maddEpi16(x, y));
+  }
+
   inline Vec vecSetZero() {
     return _mm_setzero_si128();
   }
@@ -166,9 +299,31 @@ namespace SIMD {
 
     return _mm_cvtsi128_si32(sum32);
   }
+}
+
+namespace SIMD {
 
+#if defined(USE_DISPATCH)
+
+  // Enough for any instruction set
+  constexpr int Alignment = 64;
+
+#else
+
+#if defined(SIMD_AVX512_VNNI)
+  using namespace Avx512Vnni;
+#elif defined(SIMD_AVX512)
+  using namespace Avx512;
+#elif defined(SIMD_AVX2_VNNI)
+  using namespace Avx2Vnni;
+#elif defined(SIMD_AVX2)
+  using namespace Avx2;
+#else
+  using namespace Sse2;
 #endif
 
   constexpr int Alignment = std::max<int>(8, sizeof(Vec));
 
-}
\ No newline at end of file
+#endif
+
+}
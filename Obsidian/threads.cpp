@@ -1,5 +1,13 @@
 #include "threads.h"
+#include "affinity.h"
+#include "uci.h"
+
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <set>
+#include <sstream>
 
 namespace Threads {
 
@@ -31,6 +39,39 @@ namespace Threads {
     return result;
   }
 
+  uint64_t totalDeferrals() {
+    uint64_t result = 0;
+    for (int i = 0; i < searchThreads.size(); i++)
+      result += searchThreads[i]->deferrals;
+    return result;
+  }
+
+  TT::Stats totalTTStats() {
+    TT::Stats result = TT::Stats();
+    for (int i = 0; i < searchThreads.size(); i++)
+      result += searchThreads[i]->ttStats;
+    return result;
+  }
+
+  void resetTTStats() {
+    for (int i = 0; i < searchThreads.size(); i++)
+      searchThreads[i]->ttStats = TT::Stats();
+  }
+
+  Search::EvalCacheStats totalEvalCacheStats() {
+    Search::EvalCacheStats result = Search::EvalCacheStats();
+    for (int i = 0; i < searchThreads.size(); i++) {
+      result.probes += searchThreads[i]->evalCacheStats.probes;
+      result.hits += searchThreads[i]->evalCacheStats.hits;
+    }
+    return result;
+  }
+
+  void resetEvalCacheStats() {
+    for (int i = 0; i < searchThreads.size(); i++)
+      searchThreads[i]->evalCacheStats = Search::EvalCacheStats();
+  }
+
   void waitForSearch() {
     for (int i = 0; i < searchThreads.size(); i++) {
       Search::Thread* st = searchThreads[i];
@@ -42,11 +83,19 @@ namespace Threads {
   void startSearch(Search::Settings& settings) {
     searchSettings = settings;
     searchStopped = false;
+
+    // Mark every thread as searching before waking any. Otherwise the main thread could
+    // finish first, and take a helper which hasn't started yet for one which is done,
+    // with the results of the previous search
     for (int i = 0; i < searchThreads.size(); i++) {
       Search::Thread* st = searchThreads[i];
+      std::lock_guard lock(st->mutex);
+      st->completedDepth = 0;
       st->searching = true;
-      st->cv.notify_all();
     }
+
+    for (int i = 0; i < searchThreads.size(); i++)
+      searchThreads[i]->cv.notify_all();
   }
 
   Search::Settings& getSearchSettings() {
@@ -57,22 +106,167 @@ namespace Threads {
     searchStopped = true;
   }
 
+  // The timer thread sleeps on the steady clock until the deadline of the search, if any
+  std::thread timerThread;
+  std::mutex timerMutex;
+  std::condition_variable timerCv;
+  int64_t timerDeadline = 0;
+  bool timerExit = false;
+
+  void timerLoop() {
+    std::unique_lock lock(timerMutex);
+
+    while (!timerExit) {
+      if (!timerDeadline) {
+        timerCv.wait(lock);
+        continue;
+      }
+
+      const std::chrono::steady_clock::time_point deadline{std::chrono::milliseconds(timerDeadline)};
+
+      if (timerCv.wait_until(lock, deadline) == std::cv_status::timeout
+        && timerDeadline
+        && timeMillis() >= timerDeadline)
+      {
+        timerDeadline = 0;
+        stopSearch();
+      }
+    }
+  }
+
+  void setDeadline(int64_t deadline) {
+    std::lock_guard lock(timerMutex);
+    timerDeadline = deadline;
+    timerCv.notify_all();
+  }
+
+  void clearDeadline() {
+    setDeadline(0);
+  }
+
+  void startTimer() {
+    if (!timerThread.joinable())
+      timerThread = std::thread(timerLoop);
+  }
+
+  void stopTimer() {
+    if (!timerThread.joinable())
+      return;
+
+    {
+      std::lock_guard lock(timerMutex);
+      timerExit = true;
+      timerCv.notify_all();
+    }
+
+    timerThread.join();
+    timerExit = false;
+  }
+
+  void runOnAllThreads(const std::function<void(int)>& func) {
+    waitForSearch();
+
+    for (int i = 0; i < searchThreads.size(); i++) {
+      Search::Thread* st = searchThreads[i];
+      std::lock_guard lock(st->mutex);
+      st->task = [&func, i] { func(i); };
+      st->searching = true;
+      st->cv.notify_all();
+    }
+
+    waitForSearch();
+  }
+
+  // Pin search threads to cpus, with the same order for any thread count,
+  // and report the thread to cpu map
+  std::vector<Affinity::Cpu> threadCpus(int threadCount) {
+    std::vector<Affinity::Cpu> order = Affinity::pinningOrder();
+
+    if (order.empty()) {
+      std::cout << "info string Thread Affinity is not supported on this system" << std::endl;
+      return {};
+    }
+
+    std::vector<Affinity::Cpu> cpus;
+    for (int i = 0; i < threadCount; i++)
+      cpus.push_back(order[i % order.size()]);
+
+    std::set<int> nodes, l3s;
+    int smtSiblings = 0;
+    std::ostringstream map;
+
+    for (int i = 0; i < threadCount; i++) {
+      nodes.insert(cpus[i].node);
+      l3s.insert(cpus[i].l3);
+      smtSiblings += cpus[i].smt > 0;
+      map << " " << i << ":" << cpus[i].id;
+    }
+
+    std::cout << "info string Pinning " << threadCount << " threads to " << std::min<size_t>(threadCount, order.size())
+              << " of " << order.size() << " cpus, NUMA nodes " << nodes.size() << ", L3 domains " << l3s.size()
+              << ", on SMT siblings " << smtSiblings << std::endl;
+    std::cout << "info string Thread:cpu" << map.str() << std::endl;
+
+    return cpus;
+  }
+
+  void setAffinity(bool pinned) {
+    if (!pinned) {
+      runOnAllThreads([](int) { Affinity::unpinCurrentThread(); });
+      return;
+    }
+
+    std::vector<Affinity::Cpu> cpus = threadCpus(searchThreads.size());
+    if (!cpus.empty())
+      runOnAllThreads([&](int idx) { Affinity::pinCurrentThread(cpus[idx].id); });
+  }
+
   void setThreadCount(int threadCount) {
     waitForSearch();
 
+    // Wake up all the threads first, so that they exit in parallel
     for (int i = 0; i < searchThreads.size(); i++) {
+      std::lock_guard lock(searchThreads[i]->mutex);
       searchThreads[i]->exitThread = true;
       searchThreads[i]->searching = true; // <-- the predicate
       searchThreads[i]->cv.notify_all();
+    }
+
+    for (int i = 0; i < searchThreads.size(); i++) {
       searchThreads[i]->thread.join();
       delete searchThreads[i];
     }
 
     searchThreads.clear();
 
-    for (int i = 0; i < threadCount; i++) {
-      searchThreads.push_back(new Search::Thread());
+    if (!threadCount) {
+      stopTimer();
+      return;
     }
+
+    startTimer();
+
+    clock_t startTime = timeMillis();
+
+    // The tables of a thread are not touched on construction, each thread clears its own.
+    // This is parallel, and places the memory on the NUMA node of the thread
+    for (int i = 0; i < threadCount; i++)
+      searchThreads.push_back(new Search::Thread(i));
+
+    std::vector<Affinity::Cpu> cpus;
+    if (Options["Thread Affinity"])
+      cpus = threadCpus(threadCount);
+
+    runOnAllThreads([&](int idx) {
+      if (!cpus.empty())
+        Affinity::pinCurrentThread(cpus[idx].id);
+
+      searchThreads[idx]->resetHistories();
+    });
+
+    if (UCI::debugMode)
+      std::cout << "info string " << threadCount << " search thread" << (threadCount > 1 ? "s" : "")
+                << " ready in " << (timeMillis() - startTime) << " ms" << std::endl;
   }
 
 }
\ No newline at end of file
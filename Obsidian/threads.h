@@ -6,6 +6,8 @@
 
 namespace Threads {
 
+  constexpr int MaxThreads = 1024;
+
   extern std::vector<Search::Thread*> searchThreads;
 
   Search::Thread* mainThread();
@@ -16,6 +18,16 @@ namespace Threads {
 
   uint64_t totalTbHits();
 
+  uint64_t totalDeferrals();
+
+  TT::Stats totalTTStats();
+
+  void resetTTStats();
+
+  Search::EvalCacheStats totalEvalCacheStats();
+
+  void resetEvalCacheStats();
+
   void waitForSearch();
 
   void startSearch(Search::Settings& settings);
@@ -24,5 +36,17 @@ namespace Threads {
 
   void stopSearch();
 
+  /// Have the timer thread stop the search at deadline, a timeMillis() value,
+  /// however busy the search threads are
+  void setDeadline(int64_t deadline);
+
+  void clearDeadline();
+
+  /// Run func(threadIdx) on every search thread in parallel, and wait for all of them
+  void runOnAllThreads(const std::function<void(int)>& func);
+
+  /// Pin each search thread to its own cpu (see Affinity::pinningOrder), or unpin them
+  void setAffinity(bool pinned);
+
   void setThreadCount(int threadCount);
 }
\ No newline at end of file
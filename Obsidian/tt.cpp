@@ -1,6 +1,23 @@
 #include "tt.h"
+#include "memory.h"
+#include "threads.h"
+#include "uci.h"
 
+#include <atomic>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace TT {
 
@@ -9,9 +26,46 @@ namespace TT {
   uint8_t tableAge;
   Bucket* buckets = nullptr;
   uint64_t bucketCount;
+  Memory::PageType pageType;
+
+  thread_local Stats* threadStats = nullptr;
+
+  // Split the table in one slice per search thread, and have each thread run func(start, count)
+  // on its own slice. This is much faster with big hashes, and lets the first touch place
+  // the pages near the threads using them.
+  // The threads only take the work once they are done searching, and an infinite search
+  // only ends on input, so a running search is stopped first
+  template<typename Func>
+  void forEachSlice(const Func& func) {
+    const int threadCount = Threads::searchThreads.size();
+
+    if (threadCount == 0) {
+      func(0, bucketCount);
+      return;
+    }
+
+    Threads::stopSearch();
+    Threads::waitForSearch();
+
+    Threads::runOnAllThreads([&func, threadCount](int idx) {
+      uint64_t sliceSize = bucketCount / threadCount;
+      uint64_t start = sliceSize * idx;
+
+      if (idx == threadCount - 1)
+        sliceSize = bucketCount - start;
+
+      func(start, sliceSize);
+    });
+  }
+
+  void clearBuckets() {
+    forEachSlice([](uint64_t start, uint64_t count) {
+      memset(&buckets[start], 0, sizeof(Bucket) * count);
+    });
+  }
 
   void clear() {
-    memset(buckets, 0, sizeof(Bucket) * bucketCount);
+    clearBuckets();
     tableAge = 0;
   }
 
@@ -20,14 +74,57 @@ namespace TT {
   }
 
   void resize(size_t megaBytes) {
-    size_t bytes = megaBytes * 1024ULL * 1024ULL;
-    bucketCount = bytes / sizeof(Bucket);
+    clock_t startTime = timeMillis();
+
+    // Searching threads must not see the table go away
+    Threads::stopSearch();
+    Threads::waitForSearch();
+
+    Memory::largePageFree(buckets, sizeof(Bucket) * bucketCount, pageType);
+
+    // Huge pages fall back to normal ones by themselves. If even those can't be had,
+    // go on with a smaller table rather than quit in the middle of a game
+    size_t allocatedMB = megaBytes;
+
+    while (true) {
+      bucketCount = allocatedMB * 1024ULL * 1024ULL / sizeof(Bucket);
+      buckets = (Bucket*) Memory::largePageAlloc(sizeof(Bucket) * bucketCount, pageType);
+
+      if (buckets || allocatedMB == 1)
+        break;
+
+      allocatedMB /= 2;
+    }
+
+    if (!buckets) {
+      std::cout << "info string Failed to allocate the hash table" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    if (allocatedMB != megaBytes)
+      std::cout << "info string Failed to allocate " << megaBytes << " MB for the hash table, using "
+                << allocatedMB << " MB" << std::endl;
+
+    // The placement policy must be set before the memory is touched for the first time
+    bool interleaved = Options["Hash NUMA"] == "Interleave"
+                    && Memory::numaInterleave(buckets, sizeof(Bucket) * bucketCount);
+
+    clearBuckets();
+    tableAge = 0;
 
-    if (buckets != nullptr)
-      delete[] buckets;
+    std::cout << "info string Hash " << allocatedMB << " MB, "
+              << Memory::pageTypeToString(pageType) << ", "
+              << (interleaved ? "interleaved" : "local") << " placement"
+              << ", NUMA nodes: " << Memory::numaNodeCount();
 
-    buckets = new Bucket[bucketCount];
-    clear();
+    if (UCI::debugMode)
+      std::cout << ", allocated and cleared in " << (timeMillis() - startTime) << " ms";
+
+    std::cout << std::endl;
+  }
+
+  bool inTable(const Entry* entry) {
+    return entry >= buckets[0].entries && entry < buckets[bucketCount].entries;
   }
 
   Bucket* getBucket(Key key) {
@@ -40,14 +137,39 @@ namespace TT {
     __builtin_prefetch(getBucket(key));
   }
 
-  Entry* probe(Key key, bool& hit) {
+  bool peek(Key key, Entry& ttData) {
+    Entry* entries = getBucket(key)->entries;
+
+    for (int i = 0; i < EntriesPerBucket; i++) {
+      ttData = entries[i];
+
+      if (ttData.matches(key) && !ttData.isEmpty())
+        return true;
+    }
+
+    return false;
+  }
+
+  Entry* probe(Key key, bool& hit, Entry& ttData) {
 
     Entry* entries = getBucket(key)->entries;
 
+    if (threadStats)
+      threadStats->probes++;
+
     for (int i = 0; i < EntriesPerBucket; i++) {
-      if (entries[i].matches(key) || entries[i].isEmpty()) {
-        hit = ! entries[i].isEmpty();
+      // Work on a copy, other threads may be writing to this entry
+      ttData = entries[i];
+
+      if (ttData.matches(key) || ttData.isEmpty()) {
+        hit = ! ttData.isEmpty();
         entries[i].updateAge();
+
+        if (threadStats) {
+          threadStats->hits += hit;
+          threadStats->emptyHits += !hit;
+        }
+
         return & entries[i];
       }
     }
@@ -58,45 +180,86 @@ namespace TT {
       if (entries[i].getQuality() < worstEntry->getQuality())
         worstEntry = & entries[i];
     }
-    
+
     hit = false;
     return worstEntry;
   }
 
+  size_t sizeBytes() {
+    return sizeof(Bucket) * bucketCount;
+  }
+
   int hashfull() {
+    // Sample one bucket from each of 1000 equal strata of the table, at a pseudo random
+    // offset, so that the whole table is represented
+    const uint64_t stride = bucketCount / 1000;
+
     int entryCount = 0;
     for (int i = 0; i < 1000; i++) {
+      uint64_t offset = (uint64_t(i) * 0x9E3779B97F4A7C15ULL >> 32) % stride;
+      Entry* entries = buckets[i * stride + offset].entries;
+
       for (int j = 0; j < EntriesPerBucket; j++) {
-        Entry* entry = & buckets[i].entries[j];
-        if (entry->getAge() == tableAge && !entry->isEmpty())
+        if (entries[j].getAge() == tableAge && !entries[j].isEmpty())
           entryCount++;
       }
     }
     return entryCount / EntriesPerBucket;
   }
 
+  std::string statsToString(const Stats& stats) {
+    auto percent = [&](uint64_t n) {
+      std::ostringstream ss;
+      ss << std::fixed << std::setprecision(2) << (100.0 * n / std::max<uint64_t>(stats.probes, 1)) << "%";
+      return ss.str();
+    };
+
+    std::ostringstream ss;
+    ss << "probes " << stats.probes
+       << " hits " << stats.hits << " (" << percent(stats.hits) << ")"
+       << " empty " << stats.emptyHits << " (" << percent(stats.emptyHits) << ")"
+       << " replaced-age " << stats.replacedOld << " (" << percent(stats.replacedOld) << ")"
+       << " replaced-depth " << stats.replacedShallow << " (" << percent(stats.replacedShallow) << ")";
+    return ss.str();
+  }
+
   void Entry::store(Key _key, Flag _bound, int _depth, Move _move, Score _score, Score _eval, bool isPV, int ply) {
 
-     if (!matches(_key) || _move)
-        this->move = _move;
+    // Build the new entry in private, then write it back at once
+    Entry entry = *this;
+    const bool sameKey = entry.matches(_key);
+
+    // Only count stores into the shared table: probe() counts its lookups, not those of the qsearch cache
+    if (threadStats && !sameKey && !entry.isEmpty() && inTable(this)) {
+      if (entry.getAge() != tableAge)
+        threadStats->replacedOld++;
+      else
+        threadStats->replacedShallow++;
+    }
+
+    if (!sameKey || _move)
+      entry.move = _move;
 
     if (_score != SCORE_NONE) {
       if (_score >= SCORE_TB_WIN_IN_MAX_PLY)
         _score += ply;
-      else if (score <= SCORE_TB_LOSS_IN_MAX_PLY)
+      else if (entry.score <= SCORE_TB_LOSS_IN_MAX_PLY)
         _score -= ply;
     }
     
     if ( _bound == FLAG_EXACT
-      || !matches(_key)
-      || _depth + 4 + 2*isPV > this->depth) {
-
-        this->key16 = (uint16_t) _key;
-        this->depth = _depth;
-        this->score = _score;
-        this->staticEval = _eval;
-        this->agePvBound = _bound | (isPV << 2) | (tableAge << 3);
+      || !sameKey
+      || _depth + 4 + 2*isPV > entry.depth) {
+
+        entry.depth = _depth;
+        entry.score = _score;
+        entry.staticEval = _eval;
+        entry.agePvBound = _bound | (isPV << 2) | (tableAge << 3);
       }
+
+    entry.key16 = (uint16_t) _key ^ entry.checksum();
+
+    *this = entry;
   }
 
   void Entry::updateAge() {
@@ -107,4 +270,183 @@ namespace TT {
     int ageDistance = (MAX_AGE + tableAge - getAge()) % MAX_AGE;
     return depth - 8 * ageDistance;
   }
+
+  struct FileHeader {
+    char magic[8];
+    uint64_t bucketSize;
+    uint64_t bucketCount;
+    uint64_t networkHash;
+    uint8_t tableAge;
+  };
+
+  constexpr char FileMagic[8] = { 'O', 'B', 'S', 'H', 'A', 'S', 'H', '1' };
+
+  void save(const std::string& fileName) {
+    clock_t startTime = timeMillis();
+
+    // Zero the padding too, so that the file holds no undefined bytes
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FileMagic, sizeof(FileMagic));
+    header.bucketSize = sizeof(Bucket);
+    header.bucketCount = bucketCount;
+    header.networkHash = NNUE::networkHash();
+    header.tableAge = tableAge;
+
+    std::ofstream file(fileName, std::ios::binary);
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) buckets, sizeof(Bucket) * bucketCount);
+
+    if (!file) {
+      std::cout << "info string Failed to save the hash to " << fileName << std::endl;
+      return;
+    }
+
+    std::cout << "info string Hash saved to " << fileName
+              << " in " << (timeMillis() - startTime) << " ms" << std::endl;
+  }
+
+  void load(const std::string& fileName) {
+    clock_t startTime = timeMillis();
+
+#if defined(_WIN32)
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    const size_t fileSize = file ? size_t(file.tellg()) : 0;
+    std::vector<char> contents(fileSize);
+    file.seekg(0);
+    file.read(contents.data(), fileSize);
+    const char* data = contents.data();
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    struct stat st;
+    const size_t fileSize = (fd != -1 && fstat(fd, &st) == 0) ? size_t(st.st_size) : 0;
+    void* mapping = fileSize ? mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    const char* data = mapping != MAP_FAILED ? (const char*) mapping : nullptr;
+    if (fd != -1)
+      close(fd);
+#endif
+
+    FileHeader header = {};
+    std::string error;
+
+    if (!data || fileSize < sizeof(header))
+      error = "cannot read " + fileName;
+    else {
+      memcpy(&header, data, sizeof(header));
+
+      if (memcmp(header.magic, FileMagic, sizeof(FileMagic)) || header.bucketSize != sizeof(Bucket))
+        error = "not a hash file of this build";
+      // Divide rather than multiply, so that a corrupt bucket count can't wrap around
+      else if ( (fileSize - sizeof(header)) % sizeof(Bucket)
+             || (fileSize - sizeof(header)) / sizeof(Bucket) != header.bucketCount)
+        error = "truncated file";
+      else if (header.networkHash != NNUE::networkHash())
+        error = "saved with a different network";
+    }
+
+    if (error.empty()) {
+      // Adapt the table size to the file, through the option so that it stays in sync
+      if (header.bucketCount != bucketCount)
+        Options["Hash"] = std::to_string(header.bucketCount * sizeof(Bucket) / (1024 * 1024));
+
+      if (header.bucketCount != bucketCount)
+        error = "cannot resize the hash to match the file";
+    }
+
+    if (error.empty()) {
+      const Bucket* savedBuckets = (const Bucket*) (data + sizeof(header));
+
+      forEachSlice([savedBuckets](uint64_t start, uint64_t count) {
+        memcpy(&buckets[start], &savedBuckets[start], sizeof(Bucket) * count);
+      });
+      tableAge = header.tableAge;
+    }
+
+#if !defined(_WIN32)
+    if (data)
+      munmap(mapping, fileSize);
+#endif
+
+    if (!error.empty()) {
+      std::cout << "info string Failed to load the hash: " << error << std::endl;
+      return;
+    }
+
+    std::cout << "info string Hash loaded from " << fileName
+              << " in " << (timeMillis() - startTime) << " ms" << std::endl;
+  }
+
+  void stressTest(int threadCount, int seconds) {
+    constexpr int HotBuckets = 16;
+    constexpr int KeyCount = 64;
+
+    // Draw keys that all land in the first few buckets, so that threads keep
+    // overwriting each other's entries. Entries only store 16 bits of the key, so key i
+    // gets i as its low 16 bits: no two keys can then match the same untorn entry, and
+    // a read of data which doesn't belong to the key is always a torn write
+    Key keys[KeyCount];
+    std::mt19937_64 gen(12345);
+    for (int i = 0; i < KeyCount; i++) {
+      using uint128 = unsigned __int128;
+      do {
+        uint128 target = (uint128(i % HotBuckets) << 64) + gen();
+        keys[i] = (Key(target / bucketCount) & ~Key(0xFFFF)) | Key(i);
+      } while (getBucket(keys[i]) != &buckets[i % HotBuckets]);
+    }
+
+    // Every field of the entry is derived from the key, so that any mixing is visible
+    auto expectedMove  = [](Key k) { return Move(uint16_t(k >> 16) | 1); };
+    auto expectedScore = [](Key k) { return Score(int(k >> 32) % 10000); };
+    auto expectedEval  = [](Key k) { return Score(int(k >> 48) % 10000); };
+    auto expectedDepth = [](Key k) { return int(1 + (k >> 40) % 100); };
+
+    std::atomic<uint64_t> totalProbes(0), totalHits(0), totalCorrupted(0);
+
+    clearBuckets();
+
+    const clock_t endTime = timeMillis() + seconds * 1000;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+      threads.emplace_back([&, t] {
+        std::mt19937_64 rng(t);
+        uint64_t probes = 0, hits = 0, corrupted = 0;
+
+        while ((probes & 1023) || timeMillis() < endTime) {
+          Key key = keys[rng() % KeyCount];
+
+          bool hit;
+          Entry ttData;
+          Entry* entry = probe(key, hit, ttData);
+          probes++;
+
+          if (hit) {
+            hits++;
+            if ( ttData.getMove() != expectedMove(key)
+              || ttData.getScore(0) != expectedScore(key)
+              || ttData.getStaticEval() != expectedEval(key)
+              || ttData.getDepth() != expectedDepth(key))
+              corrupted++;
+          }
+
+          entry->store(key, FLAG_EXACT, expectedDepth(key), expectedMove(key),
+                       expectedScore(key), expectedEval(key), false, 0);
+        }
+
+        totalProbes += probes;
+        totalHits += hits;
+        totalCorrupted += corrupted;
+      });
+    }
+
+    for (std::thread& th : threads)
+      th.join();
+
+    clearBuckets();
+
+    std::cout << "info string TT stress test: threads " << threadCount
+              << " probes " << totalProbes
+              << " hits " << totalHits
+              << " corrupted " << totalCorrupted << std::endl;
+  }
 }
\ No newline at end of file
@@ -14,7 +14,15 @@ namespace TT {
     FLAG_EXACT = FLAG_LOWER | FLAG_UPPER,
     FLAG_PV = 4;
 
-  constexpr int EntriesPerBucket = 3;
+  // Size of a bucket in bytes. Build with -DTT_BUCKET_SIZE=64 to have buckets
+  // that fill a whole cache line, instead of two buckets sharing one
+#ifdef TT_BUCKET_SIZE
+  constexpr int BucketSize = TT_BUCKET_SIZE;
+#else
+  constexpr int BucketSize = 32;
+#endif
+
+  static_assert(BucketSize == 32 || BucketSize == 64, "TT buckets must be 32 or 64 bytes");
 
   struct Entry {
 
@@ -24,8 +32,10 @@ namespace TT {
 
     int getQuality();
 
+    // The stored key is xor-ed with a checksum of the data, so that an entry torn by
+    // concurrent writes of different threads will (almost always) fail to match
     inline bool matches(Key key) const {
-      return this->key16 == (uint16_t) key;
+      return this->key16 == ((uint16_t) key ^ checksum());
     }
 
     inline Score getStaticEval() const {
@@ -75,13 +85,49 @@ namespace TT {
     uint8_t depth;
     uint16_t move;
     int16_t score;
+
+    // The age is left out, since it's rewritten on every probe
+    inline uint16_t checksum() const {
+      uint64_t data =  uint64_t(uint16_t(staticEval))
+                    | (uint64_t(move) << 16)
+                    | (uint64_t(uint16_t(score)) << 32)
+                    | (uint64_t(depth) << 48)
+                    | (uint64_t(agePvBound & (FLAG_EXACT | FLAG_PV)) << 56);
+
+      return (data * 0x9E3779B97F4A7C15ULL) >> 48;
+    }
   };
 
-  struct Bucket {
+  constexpr int EntriesPerBucket = BucketSize / sizeof(Entry);
+
+  struct alignas(BucketSize) Bucket {
     Entry entries[EntriesPerBucket];
-    int16_t padding;
+    char padding[BucketSize - EntriesPerBucket * sizeof(Entry)];
   };
 
+  static_assert(sizeof(Bucket) == BucketSize);
+
+  // Probe and store counters of a single thread, collected only while threadStats is set
+  struct Stats {
+    RelaxedCounter probes, hits;
+
+    // Misses which found an empty slot
+    RelaxedCounter emptyHits;
+
+    // Stores which overwrote the entry of another position, either from an older search or from this one
+    RelaxedCounter replacedOld, replacedShallow;
+
+    inline void operator+=(const Stats& other) {
+      probes          += other.probes;
+      hits            += other.hits;
+      emptyHits       += other.emptyHits;
+      replacedOld     += other.replacedOld;
+      replacedShallow += other.replacedShallow;
+    }
+  };
+
+  extern thread_local Stats* threadStats;
+
   // Initialize/clear the TT
   void clear();
 
@@ -91,7 +137,27 @@ namespace TT {
 
   void prefetch(Key key);
 
-  Entry* probe(Key key, bool& hit);
+  /// Returns the entry to store into. If hit, ttData is set to a consistent copy of it,
+  /// which should be used for reading, since the table is written concurrently
+  Entry* probe(Key key, bool& hit, Entry& ttData);
+
+  /// Look up key without writing to the table (no aging) and without counting stats.
+  /// Returns whether it was found, with its data in ttData
+  bool peek(Key key, Entry& ttData);
 
   int hashfull();
+
+  size_t sizeBytes();
+
+  std::string statsToString(const Stats& stats);
+
+  /// Dump the whole table to a file, to be loaded back in a later session
+  void save(const std::string& fileName);
+
+  /// Load a table saved with the same bucket layout and network, resizing the hash if needed
+  void load(const std::string& fileName);
+
+  /// Hammer a few buckets with several threads and count the reads that returned
+  /// data not belonging to the probed key. Clears the table
+  void stressTest(int threadCount, int seconds);
 }
\ No newline at end of file
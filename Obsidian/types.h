@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <cstring>
@@ -21,6 +22,39 @@ const std::string piecesChar = " PNBRQK  pnbrqk";
 constexpr int MAX_PLY = 246;
 constexpr int MAX_MOVES = 224; // 32*7
 
+// A counter which only its thread writes, and other threads may read while it changes.
+// Relaxed loads and stores are plain moves on x86, without the lock prefix of an increment
+class RelaxedCounter {
+  std::atomic<uint64_t> value = 0;
+
+public:
+
+  RelaxedCounter() = default;
+
+  RelaxedCounter(const RelaxedCounter& other) : value(uint64_t(other)) {}
+
+  inline void operator++(int) {
+    *this += 1;
+  }
+
+  inline void operator+=(uint64_t v) {
+    value.store(value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+
+  inline RelaxedCounter& operator=(uint64_t v) {
+    value.store(v, std::memory_order_relaxed);
+    return *this;
+  }
+
+  inline RelaxedCounter& operator=(const RelaxedCounter& other) {
+    return *this = uint64_t(other);
+  }
+
+  inline operator uint64_t() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
 inline int BitCount(uint64_t x) {
   return __builtin_popcountll(x);
 }
@@ -1,5 +1,6 @@
 #include "uci.h"
 #include "bench.h"
+#include "bitboard.h"
 #include "evaluate.h"
 #include "move.h"
 #include "movegen.h"
@@ -9,8 +10,12 @@
 #include "tt.h"
 #include "tuning.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -63,10 +68,32 @@ namespace {
 
   void newGame() {
 
+    // The threads only reset their tables once they are done searching,
+    // and nothing but input could end an infinite search
+    Threads::stopSearch();
+    Threads::waitForSearch();
+
+    clock_t startTime = timeMillis();
     TT::clear();
 
-    for (Search::Thread* st : Threads::searchThreads)
-      st->resetHistories();
+    if (UCI::debugMode && !Search::doingBench)
+      std::cout << "info string Hash cleared in " << (timeMillis() - startTime) << " ms" << std::endl;
+
+    // Bench wants the statistics of all of its positions
+    if (!Search::doingBench) {
+      Threads::resetTTStats();
+      Threads::resetEvalCacheStats();
+    }
+
+    // Each thread clears its own tables, in parallel
+    startTime = timeMillis();
+    Threads::runOnAllThreads([](int idx) {
+      Threads::searchThreads[idx]->resetHistories();
+      Threads::searchThreads[idx]->clearQsCache();
+    });
+
+    if (UCI::debugMode && !Search::doingBench)
+      std::cout << "info string Thread tables reset in " << (timeMillis() - startTime) << " ms" << std::endl;
   }
 
   void qc(Position& pos) {
@@ -78,6 +105,15 @@ namespace {
     }
   }
 
+  std::string evalCacheStatsToString() {
+    const Search::EvalCacheStats stats = Threads::totalEvalCacheStats();
+
+    std::ostringstream os;
+    os << "probes " << stats.probes << " hits " << stats.hits << " ("
+       << std::fixed << std::setprecision(2) << (stats.probes ? 100.0 * stats.hits / stats.probes : 0.0) << "%)";
+    return os.str();
+  }
+
   void bench() {
     constexpr int posCount = sizeof(BENCH_POSITIONS) / sizeof(char*);
 
@@ -85,6 +121,9 @@ namespace {
     clock_t elapsed = 0;
     Search::doingBench = true;
 
+    Threads::resetTTStats();
+    Threads::resetEvalCacheStats();
+
     for (int i = 0; i < posCount; i++) 
     {
       Search::Settings searchSettings;
@@ -111,11 +150,365 @@ namespace {
       }
     }
 
+    // The hit rate of each bucket layout is only counted with TT Stats, so that the plain
+    // bench measures the speed of the search alone
+    std::cout << "TT: " << TT::EntriesPerBucket << " entries per " << TT::BucketSize << " byte bucket";
+    if (Options["TT Stats"])
+      std::cout << ", " << TT::statsToString(Threads::totalTTStats());
+    std::cout << std::endl;
+
+    if (int(Options["Eval Cache"]))
+      std::cout << "Eval cache: " << evalCacheStatsToString() << std::endl;
+
     std::cout << totalNodes << " nodes " << (totalNodes * 1000 / elapsed) << " nps" << std::endl;
 
     Search::doingBench = false;
   }
 
+  // smpbench [depth] [positions] [threads...]
+  // Search the first bench positions to a fixed depth with each thread count, and report the
+  // time to depth. Builds with RECORD_VISITS also report the share of searched nodes which no
+  // other node of the search repeated (the same position searched twice, by one thread or by two
+  // of them, counts once)
+  void smpBench(std::istringstream& is) {
+    constexpr int posCount = sizeof(BENCH_POSITIONS) / sizeof(char*);
+
+    int depth = 10, positions = 8, threadCount;
+    std::vector<int> threadCounts;
+
+    is >> depth >> positions;
+    while (is >> threadCount)
+      threadCounts.push_back(std::clamp(threadCount, 1, Threads::MaxThreads));
+
+    if (threadCounts.empty())
+      threadCounts = { 1, 8, 32, 128 };
+
+    positions = std::clamp(positions, 1, posCount);
+
+    Threads::stopSearch();
+    Threads::waitForSearch();
+
+    Search::doingBench = true;
+    Search::recordVisits = true;
+
+    clock_t firstElapsed = 0;
+
+    for (int threads : threadCounts) {
+      Threads::setThreadCount(threads);
+
+      uint64_t nodes = 0, uniqueNodes = 0, deferrals = 0;
+      clock_t elapsed = 0;
+
+      for (int i = 0; i < positions; i++) {
+        Search::Settings searchSettings;
+        searchSettings.depth = depth;
+
+        std::istringstream posStr(BENCH_POSITIONS[i]);
+        position(searchSettings.position, posStr);
+
+        newGame();
+
+        searchSettings.startTime = timeMillis();
+        Threads::startSearch(searchSettings);
+        Threads::waitForSearch();
+
+        elapsed += timeMillis() - searchSettings.startTime;
+        deferrals += Threads::totalDeferrals();
+
+        if constexpr (!Search::RecordVisits) {
+          nodes += Threads::totalNodes();
+          continue;
+        }
+
+        std::vector<Key> keys;
+        for (Search::Thread* st : Threads::searchThreads) {
+          keys.insert(keys.end(), st->visitedKeys.begin(), st->visitedKeys.end());
+          st->visitedKeys = std::vector<Key>();
+        }
+
+        std::sort(keys.begin(), keys.end());
+
+        nodes += keys.size();
+        uniqueNodes += std::unique(keys.begin(), keys.end()) - keys.begin();
+      }
+
+      elapsed = std::max<clock_t>(1, elapsed);
+      if (!firstElapsed)
+        firstElapsed = elapsed;
+
+      std::cout << "Threads " << std::setw(4) << threads
+                << ": depth " << depth << " in " << elapsed << " ms"
+                << ", speedup " << std::fixed << std::setprecision(2) << double(firstElapsed) / elapsed
+                << ", nodes " << nodes;
+
+      if (Search::RecordVisits)
+        std::cout << ", unique " << std::setprecision(1) << (nodes ? 100.0 * uniqueNodes / nodes : 0.0) << "%";
+
+      std::cout << ", deferred moves " << deferrals << std::endl;
+    }
+
+    Search::recordVisits = false;
+    Search::doingBench = false;
+
+    Threads::setThreadCount(int(Options["Threads"]));
+  }
+
+  void ttStress(std::istringstream& is) {
+    int threadCount = 8, seconds = 5;
+    is >> threadCount >> seconds;
+
+    Threads::stopSearch();
+    Threads::waitForSearch();
+    TT::stressTest(threadCount, seconds);
+  }
+
+  void ttCommand(std::istringstream& is) {
+    std::string token;
+    is >> token;
+
+    if (token != "stats") {
+      std::cout << "Unknown command: 'tt " << token << "'." << std::endl;
+      return;
+    }
+
+    if (!Options["TT Stats"])
+      std::cout << "info string TT statistics are off, enable them with the 'TT Stats' option" << std::endl;
+
+    std::cout << "info string TT stats: " << TT::statsToString(Threads::totalTTStats())
+              << " hashfull " << TT::hashfull() << std::endl;
+  }
+
+  void hashFile(std::istringstream& is, bool save) {
+    std::string fileName;
+    std::getline(is >> std::ws, fileName);
+
+    if (fileName.empty()) {
+      std::cout << "info string Missing file name" << std::endl;
+      return;
+    }
+
+    // Nothing but input could end an infinite search, so stop it
+    Threads::stopSearch();
+    Threads::waitForSearch();
+
+    if (save)
+      TT::save(fileName);
+    else
+      TT::load(fileName);
+  }
+
+  // Whether the board (with one king per side), side to move, castling and en passant fields
+  // of a FEN are well formed. setToFen trusts its input, so anything else must not reach it
+  bool validFenFields(const std::string fields[4]) {
+    int rank = 0, file = 0;
+
+    for (char c : fields[0]) {
+      if (c == '/') {
+        if (file != 8)
+          return false;
+        rank++;
+        file = 0;
+      }
+      else if (c >= '1' && c <= '8')
+        file += c - '0';
+      else if (piecesChar.find(c) != std::string::npos && c != ' ')
+        file++;
+      else
+        return false;
+
+      if (file > 8)
+        return false;
+    }
+
+    if ( rank != 7 || file != 8
+      || std::count(fields[0].begin(), fields[0].end(), 'K') != 1
+      || std::count(fields[0].begin(), fields[0].end(), 'k') != 1)
+      return false;
+
+    if (fields[1] != "w" && fields[1] != "b")
+      return false;
+
+    if (fields[2] != "-") {
+      std::string seen;
+      for (char c : fields[2])
+        if (std::string("KQkq").find(c) == std::string::npos || seen.find(c) != std::string::npos)
+          return false;
+        else
+          seen += c;
+    }
+
+    return fields[3] == "-"
+        || (fields[3].size() == 2 && fields[3][0] >= 'a' && fields[3][0] <= 'h'
+                                  && (fields[3][1] == '3' || fields[3][1] == '6'));
+  }
+
+  // Whether the side to move can't capture the other king
+  bool validPosition(const Position& pos) {
+    return !pos.attackersTo(pos.kingSquare(~pos.sideToMove), pos.sideToMove);
+  }
+
+  // The first fields of a FEN or EPD line as a full FEN, or an empty string if the line
+  // doesn't start with a valid FEN. EPD opcodes and anything after the FEN (results, scores, ...)
+  // are ignored
+  std::string lineToFen(const std::string& line) {
+    std::istringstream is(line);
+    std::string fields[6], token;
+
+    for (int i = 0; i < 4; i++)
+      if (!(is >> fields[i]))
+        return "";
+
+    if (!validFenFields(fields))
+      return "";
+
+    // Move counters are optional, EPD doesn't have them
+    fields[4] = "0";
+    fields[5] = "1";
+    for (int i = 4; i < 6 && is >> token && std::isdigit((unsigned char) token[0]); i++)
+      fields[i] = token;
+
+    return fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3] + " " + fields[4] + " " + fields[5];
+  }
+
+  // evalbatch <input> <output> [csv|bin]
+  // Statically evaluate every FEN / EPD line of input with all the search threads.
+  // Lines which don't start with a valid position are skipped and counted.
+  // csv writes "fen,eval,cp" lines, bin a little endian int32 eval per position, in input order.
+  // Evals are raw network outputs, from white's point of view like the eval command
+  void evalBatch(std::istringstream& is) {
+    constexpr int BatchSize = 32768;
+
+    std::string inputFile, outputFile, format = "csv";
+    is >> inputFile >> outputFile >> format;
+
+    const bool binary = format == "bin";
+
+    std::ifstream input(inputFile);
+    std::ofstream output(outputFile, binary ? std::ios::binary : std::ios::out);
+
+    if (!input || !output || (!binary && format != "csv")) {
+      std::cout << "info string Usage: evalbatch <input> <output> [csv|bin]" << std::endl;
+      return;
+    }
+
+    Threads::stopSearch();
+    Threads::waitForSearch();
+
+    std::vector<Position> positions;
+    std::vector<std::string> fens;
+    std::vector<Score> scores;
+    positions.reserve(BatchSize);
+
+    uint64_t total = 0, skipped = 0;
+    clock_t startTime = timeMillis();
+
+    if (!binary)
+      output << "fen,eval,cp\n";
+
+    auto flush = [&]() {
+      const int count = positions.size();
+      const int threadCount = Threads::searchThreads.size();
+      scores.resize(count);
+
+      Threads::runOnAllThreads([&](int idx) {
+        const int begin = count * idx / threadCount;
+        const int end = count * (idx + 1) / threadCount;
+        NNUE::evaluateBatch(positions.data() + begin, end - begin, scores.data() + begin);
+      });
+
+      for (int i = 0; i < count; i++) {
+        const int32_t eval = positions[i].sideToMove == WHITE ? scores[i] : -scores[i];
+
+        if (binary)
+          output.write((const char*) &eval, sizeof(eval));
+        else
+          output << fens[i] << ',' << eval << ',' << UCI::normalizeToCp(eval) << '\n';
+      }
+
+      total += count;
+      positions.clear();
+      fens.clear();
+    };
+
+    std::string line;
+    while (std::getline(input, line)) {
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      std::string fen = lineToFen(line);
+      if (fen.empty()) {
+        skipped++;
+        continue;
+      }
+
+      positions.emplace_back();
+      positions.back().setToFen(fen);
+
+      if (!validPosition(positions.back())) {
+        positions.pop_back();
+        skipped++;
+        continue;
+      }
+
+      fens.push_back(fen);
+
+      if (int(positions.size()) == BatchSize)
+        flush();
+    }
+    flush();
+
+    clock_t elapsed = std::max<clock_t>(1, timeMillis() - startTime);
+
+    std::cout << "info string Evaluated " << total << " positions in " << elapsed << " ms ("
+              << total * 1000 / elapsed << " positions/s), skipped " << skipped << " invalid lines" << std::endl;
+  }
+
+  // nnuesign <input> <output>
+  void nnueSign(std::istringstream& is) {
+    std::string input, output;
+    is >> input >> output;
+
+    if (output.empty()) {
+      std::cout << "info string Usage: nnuesign <input> <output>" << std::endl;
+      return;
+    }
+
+    NNUE::signNetwork(input, output);
+  }
+
+  std::string formatBytes(size_t bytes) {
+    std::ostringstream os;
+    if (bytes >= 1024 * 1024)
+      os << std::fixed << std::setprecision(1) << bytes / (1024.0 * 1024.0) << " MB";
+    else
+      os << (bytes + 1023) / 1024 << " KB";
+    return os.str();
+  }
+
+  // Memory footprint of the engine: each search thread, the TT and the network
+  void memory() {
+    size_t threadsTotal = 0;
+
+    for (int i = 0; i < Threads::searchThreads.size(); i++) {
+      const Search::MemoryUsage usage = Threads::searchThreads[i]->memoryUsage();
+      threadsTotal += usage.total;
+
+      std::cout << "info string Thread " << i << ": " << formatBytes(usage.total)
+                << " (histories " << formatBytes(usage.histories)
+                << ", finny " << formatBytes(usage.finny)
+                << ", accumulators " << formatBytes(usage.accumulators)
+                << ", caches " << formatBytes(usage.caches) << ")" << std::endl;
+    }
+
+    const NNUE::NetworkMemory network = NNUE::networkMemory();
+    const size_t networkTotal = network.weights + network.outputWeights;
+
+    std::cout << "info string Threads: " << formatBytes(threadsTotal) << std::endl;
+    std::cout << "info string Hash: " << formatBytes(TT::sizeBytes()) << std::endl;
+    std::cout << "info string Network: " << formatBytes(networkTotal) << " (" << network.placement << ")" << std::endl;
+    std::cout << "info string Total: " << formatBytes(threadsTotal + TT::sizeBytes() + networkTotal) << std::endl;
+  }
+
   void setoption(std::istringstream& is) {
     std::string token, name, value;
 
@@ -183,6 +576,8 @@ namespace {
 
 }
 
+bool UCI::debugMode = false;
+
 void UCI::loop(int argc, char* argv[]) {
 
   std::string token, cmd;
@@ -212,13 +607,28 @@ void UCI::loop(int argc, char* argv[]) {
 
     else if (token == "uci") {
       std::cout << "id name Obsidian " << engineVersion
+        << " (" << NNUE::simdName() << ", " << (Bitboards::pextEnabled() ? "pext" : "magics") << ")"
         << "\nid author Gabriele Lombardo"
         << Options
         << "\n" << paramsToUci()
         << "uciok" << std::endl;
     }
+    else if (token == "debug") {
+      is >> token;
+      debugMode = token == "on";
+    }
     else if (token == "qc")         qc(pos);
     else if (token == "bench")      bench();
+    else if (token == "smpbench")   smpBench(is);
+    else if (token == "nnuebench")  NNUE::benchOutputLayer(pos);
+    else if (token == "nnuesign")   nnueSign(is);
+    else if (token == "evalbatch")  evalBatch(is);
+    else if (token == "ttstress")   ttStress(is);
+    else if (token == "tt")         ttCommand(is);
+    else if (token == "memory")     memory();
+    else if (token == "evalcache")  std::cout << "info string Eval cache: " << evalCacheStatsToString() << std::endl;
+    else if (token == "savehash")   hashFile(is, true);
+    else if (token == "loadhash")   hashFile(is, false);
     else if (token == "setoption")  setoption(is);
     else if (token == "go")         go(pos, is);
     else if (token == "position")   position(pos, is);
@@ -54,6 +54,9 @@ namespace UCI {
     OnChange on_change;
   };
 
+  /// Set by the 'debug on' command. Diagnostics like allocation timings are printed only then
+  extern bool debugMode;
+
   void init(OptionsMap&);
 
   void loop(int argc, char* argv[]);
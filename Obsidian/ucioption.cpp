@@ -1,9 +1,11 @@
 #include "uci.h"
 #include "fathom/src/tbprobe.h"
+#include "nnue.h"
 #include "threads.h"
 #include "tt.h"
 
 #include <cassert>
+#include <iostream>
 #include <ostream>
 #include <sstream>
 
@@ -14,17 +16,29 @@ UCI::OptionsMap Options;
 namespace UCI {
 
 void clearHashClicked(const Option&)   {
+   clock_t startTime = timeMillis();
    TT::clear(); 
+
+   if (UCI::debugMode)
+     std::cout << "info string Hash cleared in " << (timeMillis() - startTime) << " ms" << std::endl;
 }
 
 void hashChanged(const Option& o) {
    TT::resize(size_t(o)); 
 }
 
+void hashNumaChanged(const Option&) {
+   TT::resize(size_t(Options["Hash"]));
+}
+
 void threadsChanged(const Option& o) { 
   Threads::setThreadCount(int(o)); 
 }
 
+void threadAffinityChanged(const Option& o) {
+  Threads::setAffinity(o);
+}
+
 void syzygyPathChanged(const Option& o) {
   std::string str = o;
   tb_init(str.c_str());
@@ -34,6 +48,19 @@ void syzygyPathChanged(const Option& o) {
     std::cout << "info string Syzygy tablebases failed to load" << std::endl;
 }
 
+// Searching threads read the weights and fill their finny tables with them,
+// so the network can only change between searches
+
+void evalFileChanged(const Option& o) {
+  Threads::waitForSearch();
+  NNUE::load(o, Options["NNUE SharedMemory"]);
+}
+
+void nnueSharedMemoryChanged(const Option& o) {
+  Threads::waitForSearch();
+  NNUE::load(Options["EvalFile"], o);
+}
+
 
 bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const {
 
@@ -48,10 +75,19 @@ void init(OptionsMap& o) {
 
   o["Hash"]              << Option(64, 1, MaxHashMB, hashChanged);
   o["Clear Hash"]        << Option(clearHashClicked);
-  o["Threads"]           << Option(1, 1, 1024, threadsChanged);
+  o["Hash NUMA"]         << Option("Interleave var Interleave var Local", "Interleave", hashNumaChanged);
+  o["TT Stats"]          << Option(false);
+  o["Threads"]           << Option(1, 1, Threads::MaxThreads, threadsChanged);
+  o["Thread Affinity"]   << Option(false, threadAffinityChanged);
+  o["SMP Skip Depths"]   << Option(0, 0, 8);
+  o["SMP Defer Moves"]   << Option(false);
   o["Move Overhead"]     << Option(10, 0, 1000);
   o["SyzygyPath"]        << Option("", syzygyPathChanged);
+  o["EvalFile"]          << Option("", evalFileChanged);
+  o["NNUE SharedMemory"] << Option(false, nnueSharedMemoryChanged);
   o["MultiPV"]           << Option(1, 1, MAX_MOVES);
+  o["QS Cache"]          << Option(0, 0, 65536);
+  o["Eval Cache"]        << Option(0, 0, 65536);
 }
 
 
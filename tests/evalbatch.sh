@@ -0,0 +1,38 @@
+#!/bin/sh
+# Feeds evalbatch valid and malformed lines: the malformed ones must be skipped and counted,
+# and the valid ones still evaluated.
+# Usage: tests/evalbatch.sh <engine>
+
+engine=${1:-./Obsidian.elf}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/input.epd" <<EOF
+rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
+fen rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
+rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq - 0 1
+rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNRR w KQkq - 0 1
+rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1
+rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQxq - 0 1
+rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq z9 0 1
+rnbq1bnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQ - 0 1
+rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKKNR w kq - 0 1
+4k3/8/8/8/8/8/4R3/4K3 w - - 0 1
+4k3/8/8/8/8/8/4R3/4K3 b - - 0 1 ; c0 "valid, black in check"
+EOF
+
+output=$(printf "evalbatch %s %s csv\nquit\n" "$dir/input.epd" "$dir/output.csv" | "$engine")
+rc=$?
+
+fail() {
+  echo "FAIL: $1"
+  echo "$output"
+  exit 1
+}
+
+[ $rc -eq 0 ] || fail "engine exited with $rc"
+echo "$output" | grep -q "Evaluated 2 positions" || fail "expected 2 positions"
+echo "$output" | grep -q "skipped 9 invalid lines" || fail "expected 9 skipped lines"
+[ "$(wc -l < "$dir/output.csv")" -eq 3 ] || fail "expected a header and 2 results"
+
+echo "PASS"